@@ -0,0 +1,253 @@
+#ifndef LINUX_MAIL_SLOTS_H
+#define LINUX_MAIL_SLOTS_H
+
+/*
+shared definitions between the LinuxMailSlots module and the user space programs
+that drive it through ioctl
+*/
+#include <linux/types.h>
+
+//IOCTL param
+#define CHANGE_MESSAGE_SIZE 100 //per file descriptor
+#define CHANGE_STORAGE_MODE 101
+#define CHANGE_SLOT_BUDGET 102  //value is the byte budget of the mailslot, the queued messages have to fit it.
+                                //a STORAGE_RING mailslot refuses it, its ring is sized on the budget at the switch and
+                                //may be mapped, set the budget before switching to the ring
+#define CHANGE_WRITE_PRIORITY 103 //per file descriptor, value in [0, LMS_PRIO_LEVELS)
+#define CHANGE_READ_FLAGS 104   //per file descriptor, value is a mask of LMS_READ_* flags
+#define CHANGE_SLOT_NODE 105    //value is the NUMA node of the mailslot memory, or LMS_NODE_FIRST_READER
+#define CHANGE_OVERFLOW_POLICY 106  //value is a LMS_OVERFLOW_* policy
+#define CHANGE_SLOT_TTL 107     //value is the time to live of the messages in ms, 0 means forever
+#define CHANGE_READ_TIMEOUT 108 //per file descriptor, value is how long a blocking read waits in ms, 0 means forever
+#define CHANGE_WRITE_TIMEOUT 109  //per file descriptor, value is how long a blocking write waits in ms, 0 means forever
+#define CHANGE_BLOCKING_MODE 110 //per file descriptor, O_NONBLOCK forces non blocking
+#define GET_SLOT_SIZE 111       //returns the message size of the file descriptor
+#define GET_ALLOC_STATS 112
+#define RECV_BATCH 113          //value is a pointer to struct lms_batch
+#define GET_SLOT_INFO 114       //value is a pointer to struct lms_slot_info
+#define PEEK_MESSAGE 115        //value is a pointer to struct lms_msg_info or 0, returns the size of the next message
+#define FORWARD_MESSAGES 116    //value is a pointer to struct lms_forward, returns the messages moved
+#define CHANGE_COALESCING 117   //per file descriptor, value is the linger time of a batch in ms, 0 turns coalescing off
+#define FLUSH_MESSAGES 118      //per file descriptor, write the pending batch now
+#define CHANGE_BUSY_POLL 119    //per file descriptor, value is how long a blocking read spins before sleeping in us, 0 means never
+#define RING_CLAIM 120          //value is RING_PRODUCER or RING_CONSUMER
+#define RING_WAIT_READABLE 121  //sleep until the ring holds a record
+#define RING_WAIT_WRITABLE 122  //sleep until the ring has value free bytes
+#define RING_NOTIFY 123         //wake the sleepers up after publishing or releasing records
+#define CHANGE_SPILL 124        //value 1 makes the mailslot spill to disk, 0 stops it
+
+//RECV_BATCH: dequeue up to max_msgs messages under a single lock acquisition, the payloads
+//are packed back to back in buf and the length of each one is stored in the lens table.
+//it blocks (in blocking mode) only for the first message and returns the messages copied
+struct lms_batch{
+  __u64 buf;        //user buffer receiving the payloads
+  __u64 lens;       //user array of max_msgs __u32
+  __u32 buf_len;
+  __u32 max_msgs;
+  __u32 count;      //out: messages copied
+  __u32 bytes;      //out: bytes copied in buf
+};
+
+//readv with more than one iovec segment takes the messages like RECV_BATCH, the segments make a
+//single buffer of records laid out like those of the ring: a __u32 length followed by the payload,
+//padded to LMS_RING_RECORD_SIZE(len). it returns the bytes of the records, read and a readv of a
+//single segment get one message
+
+//FORWARD_MESSAGES: move up to max_msgs messages, oldest first, from this mailslot to the one open
+//on fd, relinking them under the locks of both slots with no copy. readers of the destination
+//see them all at once and in order. it stops at the first message the destination has no space
+//for and never blocks. both mailslots have to be STORAGE_LIST, priorities are kept
+struct lms_forward{
+  __s32 fd;         //file descriptor of the destination mailslot
+  __u32 max_msgs;
+};
+
+//CHANGE_STORAGE_MODE values, only an empty mailslot can switch
+#define STORAGE_LIST 0  //linked list of messages (default)
+#define STORAGE_RING 1  //one contiguous ring of length prefixed records
+#define STORAGE_LOCKFREE 2  //bounded lock free queue, the slot lock is only taken to sleep
+#define STORAGE_BROADCAST 3 //every message is read by every subscriber, see below
+
+//STORAGE_BROADCAST: a message is stored once and every file descriptor subscribed to the mailslot
+//reads it at its own cursor. a file opened for reading subscribes at open, or at its first read
+//if the mailslot switched to broadcast later, and gets the messages written from then on.
+//a message leaves the mailslot when all the subscribers read it, so the budget is held back by
+//the slowest one: with LMS_OVERFLOW_DROP_OLDEST writers push the oldest message out instead and
+//the subscribers that did not read it skip it (lagged in the debugfs statistics).
+//the priority and LMS_READ_PEEK / PEEK_MESSAGE do not apply
+
+//CHANGE_WRITE_PRIORITY: a STORAGE_LIST mailslot keeps one FIFO for each level and a read always
+//takes the oldest message of the highest non empty level, like POSIX message queues.
+//every file starts at level 0, the other storage modes ignore the priority
+#define LMS_PRIO_LEVELS 16
+
+//CHANGE_READ_FLAGS values
+#define LMS_READ_PEEK 1   //like MSG_PEEK: reads copy the next message and leave it queued, one message per call,
+                          //not available on STORAGE_LOCKFREE
+
+//CHANGE_SLOT_NODE: messages (and the lock free cells) of a mailslot are allocated on its node.
+//a new mailslot takes the node of the cpu of its first reader, setting LMS_NODE_FIRST_READER
+//starts over. the ring area is not placed, it comes from the node of the task switching storage
+#define LMS_NODE_FIRST_READER -1
+
+//CHANGE_OVERFLOW_POLICY values, what a write does when the mailslot has no space for its message.
+//a dropped message counts as written, the drops are in the debugfs statistics of the slot.
+//the victims of LMS_OVERFLOW_DROP_OLDEST are taken from the lowest non empty priority level,
+//STORAGE_RING cannot take records back from its consumer and drops the newest message instead.
+//a producer mapping the ring is not affected
+#define LMS_OVERFLOW_BLOCK 0        //wait in the blocking mode of the file descriptor (default)
+#define LMS_OVERFLOW_REJECT 1       //never wait, fail like a non blocking write
+#define LMS_OVERFLOW_DROP_OLDEST 2  //discard queued messages until the new one fits
+#define LMS_OVERFLOW_DROP_NEWEST 3  //discard the new message
+
+//CHANGE_SLOT_TTL: a message older than the time to live is discarded by the next read that finds it
+//at the head of its level. STORAGE_RING records carry no enqueue time and never expire
+#define LMS_TTL_MAX_MS (24U * 3600 * 1000)
+
+//CHANGE_READ_TIMEOUT, CHANGE_WRITE_TIMEOUT: like SO_RCVTIMEO and SO_SNDTIMEO, a blocking call that
+//waited that long for a message (or for space) fails with ETIMEDOUT. the timeouts also bound
+//PEEK_MESSAGE, RECV_BATCH and the RING_WAIT_* calls
+#define LMS_TIMEOUT_MAX_MS (24U * 3600 * 1000)
+
+//CHANGE_COALESCING: the writes of the file descriptor are packed into one batch message
+//(struct lms_coalesced) that is written when the next record does not fit its message size,
+//when the first record of the batch waited the linger time, on FLUSH_MESSAGES and at close.
+//readers get the whole batch with one read and one wakeup, so every reader of the mailslot has
+//to expect batches. every iovec segment of a writev is a record. a full mailslot makes the batch
+//wait in the blocking mode of the file descriptor, except for the linger flush that never
+//sleeps and tries again one linger time later. CHANGE_MESSAGE_SIZE fails while coalescing
+#define LMS_LINGER_MAX_MS 10000U
+
+/*
+a batch starts with this header, followed by count records (a __u32 length and the payload
+padded to LMS_RING_RECORD_SIZE(len), like the ring) and by the record index at offset index:
+count __u32 offsets of the records from the start of the message, in write order
+*/
+struct lms_coalesced{
+  __u32 magic;      //LMS_COALESCED_MAGIC
+  __u32 count;
+  __u32 index;
+  __u32 reserved;
+};
+
+#define LMS_COALESCED_MAGIC 0x424d534cU
+//bytes a batch of count records of total payload len takes at most
+#define LMS_COALESCED_SIZE(count, len) (sizeof(struct lms_coalesced) + (count) * (LMS_RING_HDR_SIZE + 7 + sizeof(__u32)) + (len))
+
+//CHANGE_BUSY_POLL: like SO_BUSY_POLL, a blocking read (or PEEK_MESSAGE) of an empty mailslot
+//polls it for the budget before sleeping, a message arriving meanwhile is taken with no wakeup
+//and no context switch. it burns the cpu of the reader, non blocking reads never spin.
+//spin_hits and spin_misses in the debugfs statistics tell how often it paid off
+#define LMS_BUSY_POLL_MAX_US 100000U
+
+/*
+CHANGE_SPILL: a spilling STORAGE_LIST mailslot never makes a writer wait for space. the message that
+finds the budget exhausted, and every message after it until the log is drained again, is appended
+to the log file mailslot<minor>.log in the spill_dir module parameter and read back in write order
+as the readers make room, so the priority only orders the messages in memory. the overflow policy
+does not apply while spilling, a log that reached spill_max bytes fails the write like a non
+blocking one. at unload the messages still in memory are saved to mailslot<minor>.mem, records
+with no header. the next load of the module finds both files at the first open of the minor, puts
+the saved messages back in memory (even beyond the budget) and keeps spilling. a log that ends with a torn record after a
+crash is cut at the last complete one, records read back since the last header update come again.
+only an empty mailslot can start spilling, a mailslot with messages on disk cannot stop, and a
+spilling mailslot cannot switch storage or be the destination of FORWARD_MESSAGES. the files are
+opened and written by a kernel worker: spill_dir is resolved in the initial mount namespace, the
+files belong to root with mode 0600 and the file size limit of the writing process does not apply
+*/
+struct lms_spill_hdr{
+  __u32 magic;      //LMS_SPILL_MAGIC
+  __u32 version;    //LMS_SPILL_VERSION
+  __u64 head;       //offset of the first record not read back yet
+};
+
+//a record is this header followed by len bytes of payload, with no padding
+struct lms_spill_record{
+  __u32 len;
+  __u32 prio;
+  __u64 stamp;      //enqueue time, CLOCK_MONOTONIC ns
+};
+
+#define LMS_SPILL_MAGIC 0x4c50534cU
+#define LMS_SPILL_VERSION 1
+
+//RING_CLAIM values
+#define RING_PRODUCER 0
+#define RING_CONSUMER 1
+
+/*
+shared ring of a STORAGE_RING mailslot, mmap(MAP_SHARED, offset 0) of the device maps the
+control page followed by ctrl->size bytes of records.
+every record is a __u32 length followed by the payload, padded to LMS_RING_RECORD_SIZE(len),
+head and tail are free running byte offsets (masked with size-1) and only ever grow.
+
+a process that claimed a side with RING_CLAIM is the only one moving that index, read() or
+write() on the claimed side fail until the claiming file is closed:
+producer: wait until size-(tail-head) >= LMS_RING_RECORD_SIZE(len), write the length and the
+          payload at tail, then store tail+LMS_RING_RECORD_SIZE(len) with release semantics
+consumer: load tail with acquire semantics, if different from head read the record at head,
+          then store head+LMS_RING_RECORD_SIZE(len) with release semantics
+after a store, a full barrier and a non zero readers_waiting (or writers_waiting) means a
+task sleeps in the kernel, or the slot is polled (LMS_RING_POLLED), and RING_NOTIFY has to be called. a record is visible only once
+tail moves past it, so messages are still delivered all or nothing.
+a kernel reader that finds a record whose length does not fit the ring or the bytes published
+before tail drops every published record, moving head to tail, and sets broken.
+*/
+struct lms_ring_ctrl{
+  __u32 head;
+  __u32 tail;
+  __u32 size;
+  __u32 readers_waiting;
+  __u32 writers_waiting;
+  __u32 broken;         //malformed records met by the kernel readers
+};
+
+#define LMS_RING_POLLED 0x80000000U
+
+#define LMS_RING_HDR_SIZE sizeof(__u32)
+#define LMS_RING_RECORD_SIZE(len) ((LMS_RING_HDR_SIZE + (len) + 7) & ~((__u32) 7))
+
+//filled by GET_ALLOC_STATS, value is a pointer to this struct
+struct lms_alloc_stats{
+  __u64 pool_hits;        //messages taken from a preallocated slot reserve
+  __u64 slab_allocs;      //messages taken from the size class slab caches
+  __u64 alloc_failures;   //writes rejected because no memory was available
+  __u64 pool_frees;       //messages given back to a slot reserve
+  __u64 slab_frees;       //messages given back to the slab caches
+  __u64 pool_available;   //objects currently left in the reserve of this slot
+};
+
+//filled by GET_SLOT_INFO
+struct lms_slot_info{
+  __u32 minor;
+  __u32 storage;        //STORAGE_* mode
+  __u32 budget;         //bytes of messages the slot may hold
+  __u32 free;           //bytes still available
+  __u32 msg_size;       //largest message of this file descriptor
+  __u32 max_msg_size;   //upper limit of CHANGE_MESSAGE_SIZE
+  __u32 blocking;       //effective blocking mode of this file descriptor
+  __u32 prio;           //write priority of this file descriptor
+  __s32 node;           //NUMA node of the mailslot memory, -1 while waiting for the first reader
+  __u32 overflow;       //LMS_OVERFLOW_* policy of the slot
+  __u32 ttl_ms;         //time to live of the messages, 0 means forever
+  __u32 r_timeout_ms;   //read timeout of this file descriptor, 0 means forever
+  __u32 w_timeout_ms;   //write timeout of this file descriptor, 0 means forever
+  __u32 subscribers;    //STORAGE_BROADCAST: file descriptors reading the mailslot
+  __u32 linger_ms;      //CHANGE_COALESCING linger of this file descriptor, 0 when off
+  __u32 busy_poll_us;   //CHANGE_BUSY_POLL budget of this file descriptor
+  __u32 msgs;           //messages queued, 0 on STORAGE_RING
+  __u32 spilling;       //1 when the mailslot spills, see CHANGE_SPILL
+  __u32 spilled;        //messages waiting in the spill log
+};
+
+//filled by PEEK_MESSAGE, the next message a read would take. it waits for a message like a read
+//does, in the blocking mode of the file descriptor
+struct lms_msg_info{
+  __u32 size;           //payload bytes
+  __u32 prio;           //priority level, 0 out of STORAGE_LIST
+  __u64 stamp;          //enqueue time, CLOCK_MONOTONIC ns, 0 when unknown (STORAGE_RING, STORAGE_LOCKFREE)
+  __u32 depth;          //bytes queued in the slot
+  __u32 free;           //bytes still available
+};
+
+#endif
@@ -0,0 +1,391 @@
+/*
+throughput and latency benchmark of the mailslot engine
+
+  lms_bench [-m user|dev] [-d node_pattern] [-S list|ring|lockfree] [-s sizes] [-p producers]
+            [-c consumers] [-n slots] [-b blocking] [-k messages] [-B budget] [-y busy_poll_us]
+            [-D spill_dir]
+
+every option but -m, -d, -S, -k, -B, -y and -D takes a comma separated list, each combination of the
+lists is a run and prints one line: messages per second, MB per second and the p50, p99 and
+p999 of the write to read latency, taken from a timestamp at the start of every payload.
+each slot gets its own producers and consumers, every producer writes -k messages.
+
+-m user (default) links the engine of lms_core.c in this process on top of lms_stub.h,
+-m dev drives a loaded module through the nodes named by -d, a printf pattern that gets the
+slot index (e.g. -d /dev/mail_slot%d, the nodes made with mknod on consecutive minors), so
+the same runs can be repeated in kernel, e.g. inside a QEMU guest. the module has to be
+loaded with a max_msg_size covering the largest size.
+-y sets the CHANGE_BUSY_POLL budget of every endpoint, the consumers spin that long on an
+empty slot before sleeping.
+-D makes the list slots spill (CHANGE_SPILL) to this directory, with -k beyond the budget the
+producers run ahead of the consumers through the logs. in dev mode the module has to be loaded
+with spill_dir set, the option only turns spilling on.
+*/
+#include <unistd.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+
+#include "lms_core.h"
+
+#define MAX_LIST 16
+#define MODE_USER 0
+#define MODE_DEV 1
+
+typedef struct Int_list{
+  int val[MAX_LIST];
+  int count;
+} int_list;
+
+//one side of a slot, a session of the engine or a file descriptor of the device
+typedef struct Endpoint{
+  session s;
+  struct file f;
+  int fd;
+} endpoint;
+
+typedef struct Bench_slot{
+  slot_elem* elem;      //user mode
+  int setup_fd;         //dev mode, keeps the slot and its storage alive during the run
+  long tickets;         //messages left to the consumers
+} bench_slot;
+
+typedef struct Worker{
+  pthread_t tid;
+  bench_slot* slot;
+  int index;
+  endpoint ep;
+} worker;
+
+static int mode = MODE_USER;
+static const char* node_pattern = "Node%d";
+static int storage = STORAGE_LIST;
+static int budget = 0;
+static int busy_poll = 0;
+static const char* spill_to = NULL;
+static long messages = 100000;
+
+//the run in progress
+static int run_size;
+static int run_blocking;
+static pthread_barrier_t start_barrier;
+static u64 run_start;     //set by the first worker leaving the barrier
+static u64* samples;
+static long samples_count;
+
+
+static void parse_list(int_list* l, char* arg){
+  char* tok;
+  l->count = 0;
+  for ( tok = strtok(arg, ",") ; tok != NULL && l->count < MAX_LIST ; tok = strtok(NULL, ",") ) l->val[l->count++] = atoi(tok);
+}
+
+
+static int list_max(int_list* l){
+  int i, m = 0;
+  for ( i = 0 ; i < l->count ; i++ ) m = max(m, l->val[i]);
+  return m;
+}
+
+
+static int endpoint_open(endpoint* ep, bench_slot* bs, int slot){
+  char path[256];
+  if ( mode == MODE_USER ){
+    ep->f.f_flags = 0;
+    ep->f.private_data = &ep->s;
+    ep->s.slot = bs->elem;
+    ep->s.filp = &ep->f;
+    ep->s.blocking = run_blocking;
+    ep->s.curr_size = run_size;
+    ep->s.prio = 0;
+    ep->s.read_flags = 0;
+    ep->s.busy_poll = busy_poll;
+    return SUCCESS;
+  }
+  snprintf(path, sizeof(path), node_pattern, slot);
+  ep->fd = open(path, O_RDWR);
+  if ( ep->fd < 0 ){
+    perror(path);
+    return FAILURE;
+  }
+  if ( ioctl(ep->fd, CHANGE_BLOCKING_MODE, run_blocking) != 0 || ioctl(ep->fd, CHANGE_MESSAGE_SIZE, run_size) != 0 || ioctl(ep->fd, CHANGE_BUSY_POLL, busy_poll) != 0 ){
+    fprintf(stderr, "%s: cannot set blocking mode %d, message size %d and busy poll %d\n", path, run_blocking, run_size, busy_poll);
+    close(ep->fd);
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+
+static void endpoint_close(endpoint* ep){
+  if ( mode == MODE_DEV ) close(ep->fd);
+}
+
+
+static ssize_t endpoint_write(endpoint* ep, char* buf, size_t len){
+  if ( mode == MODE_USER ) return single_write(&ep->s, buf, len);
+  return write(ep->fd, buf, len);
+}
+
+
+static ssize_t endpoint_read(endpoint* ep, char* buf, size_t len){
+  if ( mode == MODE_USER ) return single_read(&ep->s, buf, len);
+  return read(ep->fd, buf, len);
+}
+
+
+static void started(void){
+  u64 zero = 0;
+  __atomic_compare_exchange_n(&run_start, &zero, ktime_get_ns(), 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+
+static void* producer(void* arg){
+  worker* w = arg;
+  char* buf = calloc(1, run_size);
+  u64 stamp;
+  long i;
+  ssize_t ret;
+
+  pthread_barrier_wait(&start_barrier);
+  started();
+  for ( i = 0 ; i < messages ; i++ ){
+    do {
+      stamp = ktime_get_ns();
+      memcpy(buf, &stamp, sizeof(stamp));
+      ret = endpoint_write(&w->ep, buf, run_size);
+      if ( ret != run_size ){
+        if ( run_blocking == BLOCKING ){
+          fprintf(stderr, "producer %d: write failed with %zd\n", w->index, ret);
+          exit(EXIT_FAILURE);
+        }
+        sched_yield();
+      }
+    } while ( ret != run_size );
+  }
+  free(buf);
+  return NULL;
+}
+
+
+//a consumer reads only after taking a ticket, so a blocking read always gets a message
+static void* consumer(void* arg){
+  worker* w = arg;
+  char* buf = calloc(1, run_size);
+  u64 stamp;
+  ssize_t ret;
+
+  pthread_barrier_wait(&start_barrier);
+  while ( __atomic_sub_fetch(&w->slot->tickets, 1, __ATOMIC_RELAXED) >= 0 ){
+    do {
+      ret = endpoint_read(&w->ep, buf, run_size);
+      if ( ret <= 0 ){
+        if ( run_blocking == BLOCKING ){
+          fprintf(stderr, "consumer %d: read failed with %zd\n", w->index, ret);
+          exit(EXIT_FAILURE);
+        }
+        sched_yield();
+      }
+    } while ( ret <= 0 );
+    memcpy(&stamp, buf, sizeof(stamp));
+    samples[__atomic_fetch_add(&samples_count, 1, __ATOMIC_RELAXED)] = ktime_get_ns() - stamp;
+  }
+  free(buf);
+  return NULL;
+}
+
+
+static int cmp_u64(const void* a, const void* b){
+  const u64 x = *(const u64*) a, y = *(const u64*) b;
+  return (x > y) - (x < y);
+}
+
+
+static double percentile_us(double p){
+  long i = (long) (p * (samples_count - 1));
+  return samples[i] / 1000.0;
+}
+
+
+static int slots_setup(bench_slot* slots, int nslots){
+  char path[256];
+  int i;
+  for ( i = 0 ; i < nslots ; i++ ){
+    slots[i].tickets = 0;
+    if ( mode == MODE_USER ){
+      slots[i].elem = slot_create(i);
+      if ( slots[i].elem == NULL ) return FAILURE;
+      if ( storage != STORAGE_LIST && change_storage_mode(slots[i].elem, storage) != SUCCESS ) return FAILURE;
+      if ( spill_to != NULL && change_spill(slots[i].elem, 1) != SUCCESS ) return FAILURE;
+      continue;
+    }
+    snprintf(path, sizeof(path), node_pattern, i);
+    slots[i].setup_fd = open(path, O_RDWR);
+    if ( slots[i].setup_fd < 0 ){
+      perror(path);
+      return FAILURE;
+    }
+    if ( budget > 0 && ioctl(slots[i].setup_fd, CHANGE_SLOT_BUDGET, budget) != 0 ) return FAILURE;
+    if ( ioctl(slots[i].setup_fd, CHANGE_STORAGE_MODE, storage) != 0 ) return FAILURE;
+    if ( spill_to != NULL && ioctl(slots[i].setup_fd, CHANGE_SPILL, 1) != 0 ) return FAILURE;
+  }
+  return SUCCESS;
+}
+
+
+//every message was consumed, so the accounting has to be back to an empty slot: a reservation
+//lost or released twice shows up here
+static void slots_check(bench_slot* slots, int nslots){
+  struct lms_slot_info info;
+  int i, bytes, msgs;
+  for ( i = 0 ; i < nslots ; i++ ){
+    if ( mode == MODE_USER ){
+      bytes = slot_depth(slots[i].elem);
+      msgs = atomic_read(&slots[i].elem->msgs) + slots[i].elem->spill.msgs;
+    }
+    else {
+      if ( ioctl(slots[i].setup_fd, GET_SLOT_INFO, &info) != 0 ) continue;
+      bytes = ( storage == STORAGE_RING ) ? 0 : (int) (info.budget - info.free);
+      msgs = info.msgs + info.spilled;
+    }
+    if ( bytes != 0 || msgs != 0 ) fprintf(stderr, "slot %d: %d bytes and %d messages still accounted after the run\n", i, bytes, msgs);
+  }
+}
+
+
+static void slots_teardown(bench_slot* slots, int nslots){
+  int i;
+  for ( i = 0 ; i < nslots ; i++ ){
+    if ( mode == MODE_USER ) slot_destroy(slots[i].elem);
+    else close(slots[i].setup_fd);
+  }
+}
+
+
+static void run(int size, int producers, int consumers, int nslots, int blocking){
+
+  const int nworkers = nslots * (producers + consumers);
+  bench_slot* slots = calloc(nslots, sizeof(bench_slot));
+  worker* workers = calloc(nworkers, sizeof(worker));
+  int i, w = 0;
+  u64 end;
+  double secs, msgs;
+
+  run_size = size;
+  run_blocking = blocking;
+  samples = malloc(sizeof(u64) * nslots * producers * messages);
+  samples_count = 0;
+  run_start = 0;
+  if ( slots == NULL || workers == NULL || samples == NULL || slots_setup(slots, nslots) != SUCCESS ){
+    fprintf(stderr, "cannot set up %d slots of storage %d\n", nslots, storage);
+    exit(EXIT_FAILURE);
+  }
+  pthread_barrier_init(&start_barrier, NULL, nworkers + 1);
+  for ( i = 0 ; i < nworkers ; i++ ){
+    workers[i].slot = &slots[i % nslots];
+    workers[i].index = i;
+    if ( endpoint_open(&workers[i].ep, workers[i].slot, i % nslots) != SUCCESS ) exit(EXIT_FAILURE);
+  }
+  //the first producers * nslots workers write, the others read
+  for ( i = 0 ; i < nslots ; i++ ) slots[i].tickets = producers * messages;
+  for ( w = 0 ; w < nworkers ; w++ ) pthread_create(&workers[w].tid, NULL, w < nslots * producers ? producer : consumer, &workers[w]);
+
+  pthread_barrier_wait(&start_barrier);
+  for ( w = 0 ; w < nworkers ; w++ ) pthread_join(workers[w].tid, NULL);
+  end = ktime_get_ns();
+
+  for ( i = 0 ; i < nworkers ; i++ ) endpoint_close(&workers[i].ep);
+  slots_check(slots, nslots);
+  slots_teardown(slots, nslots);
+  pthread_barrier_destroy(&start_barrier);
+
+  secs = (end - run_start) / 1e9;
+  msgs = samples_count;
+  qsort(samples, samples_count, sizeof(u64), cmp_u64);
+  printf("%-4s %-8s %6d %4d %4d %5d %5d %10.0f %10.0f %9.2f %9.2f %9.2f %9.2f\n",
+         mode == MODE_USER ? "user" : "dev", storage == STORAGE_RING ? "ring" : storage == STORAGE_LOCKFREE ? "lockfree" : "list",
+         size, producers, consumers, nslots, blocking, msgs, msgs / secs, msgs * size / secs / 1e6,
+         percentile_us(0.50), percentile_us(0.99), percentile_us(0.999));
+  fflush(stdout);
+  free(samples);
+  free(workers);
+  free(slots);
+}
+
+
+int main(int argc, char** argv){
+
+  int_list sizes = { { 64 }, 1 }, producers = { { 1 }, 1 }, consumers = { { 1 }, 1 }, nslots = { { 1 }, 1 }, blocking = { { BLOCKING }, 1 };
+  int opt, a, b, c, d, e;
+
+  while ( (opt = getopt(argc, argv, "m:d:S:s:p:c:n:b:k:B:y:D:")) != -1 ){
+    switch (opt) {
+      case 'm':
+        mode = strcmp(optarg, "dev") == 0 ? MODE_DEV : MODE_USER;
+        break;
+      case 'd':
+        node_pattern = optarg;
+        break;
+      case 'S':
+        storage = strcmp(optarg, "ring") == 0 ? STORAGE_RING : strcmp(optarg, "lockfree") == 0 ? STORAGE_LOCKFREE : STORAGE_LIST;
+        break;
+      case 's':
+        parse_list(&sizes, optarg);
+        break;
+      case 'p':
+        parse_list(&producers, optarg);
+        break;
+      case 'c':
+        parse_list(&consumers, optarg);
+        break;
+      case 'n':
+        parse_list(&nslots, optarg);
+        break;
+      case 'b':
+        parse_list(&blocking, optarg);
+        break;
+      case 'k':
+        messages = atol(optarg);
+        break;
+      case 'B':
+        budget = atoi(optarg);
+        break;
+      case 'y':
+        busy_poll = atoi(optarg);
+        break;
+      case 'D':
+        spill_to = optarg;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-m user|dev] [-d node_pattern] [-S list|ring|lockfree] [-s sizes] [-p producers] [-c consumers] [-n slots] [-b blocking] [-k messages] [-B budget] [-y busy_poll_us] [-D spill_dir]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  for ( a = 0 ; a < sizes.count ; a++ ){
+    if ( sizes.val[a] < (int) sizeof(u64) ){
+      fprintf(stderr, "message sizes have to be at least %zu bytes, the timestamp travels in the payload\n", sizeof(u64));
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( mode == MODE_USER ){
+    //the module parameters of this process, sized for the largest message
+    max_msg_size = max(max_msg_size, list_max(&sizes));
+    default_msg_size = min(default_msg_size, max_msg_size);
+    slot_budget = budget > 0 ? budget : max(slot_budget, 16 * max_msg_size);
+    max_slot_budget = max(max_slot_budget, slot_budget);
+    if ( spill_to != NULL ) spill_dir = (char*) spill_to;
+    if ( lms_core_init() != SUCCESS ) return EXIT_FAILURE;
+  }
+
+  printf("%-4s %-8s %6s %4s %4s %5s %5s %10s %10s %9s %9s %9s %9s\n",
+         "mode", "storage", "size", "prod", "cons", "slots", "block", "msgs", "msgs/s", "MB/s", "p50_us", "p99_us", "p999_us");
+  for ( a = 0 ; a < sizes.count ; a++ )
+    for ( b = 0 ; b < producers.count ; b++ )
+      for ( c = 0 ; c < consumers.count ; c++ )
+        for ( d = 0 ; d < nslots.count ; d++ )
+          for ( e = 0 ; e < blocking.count ; e++ )
+            run(sizes.val[a], producers.val[b], consumers.val[c], nslots.val[d], blocking.val[e]);
+
+  if ( mode == MODE_USER ) lms_core_exit();
+  return EXIT_SUCCESS;
+}
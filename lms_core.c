@@ -0,0 +1,2583 @@
+#include "lms_core.h"
+
+#ifdef __KERNEL__
+#define CREATE_TRACE_POINTS
+#include "lms_trace.h"
+#else
+pthread_rwlock_t lms_rcu_lock = PTHREAD_RWLOCK_INITIALIZER;
+#endif
+
+//message caches, one for each size class
+static struct kmem_cache* msg_caches[NUM_SIZE_CLASSES];
+static const char* msg_cache_names[NUM_SIZE_CLASSES] = { "lms_msg_64", "lms_msg_128", "lms_msg_256", "lms_msg_512",
+                                                          "lms_msg_1024", "lms_msg_2048", "lms_msg_4096" };
+struct alloc_counters alloc_stats;
+//sum of the budgets of the live slots
+static atomic_long_t budget_total;
+
+//number of messages preallocated for each mailslot at load time
+int slot_reserve = 0;
+module_param(slot_reserve, int, S_IRUGO);
+MODULE_PARM_DESC(slot_reserve, "messages of default_msg_size class preallocated for each mailslot");
+
+//message size and slot capacity, CHANGE_MESSAGE_SIZE and CHANGE_SLOT_BUDGET move within these limits
+int max_msg_size = MAX_MESSAGE_SIZE;
+module_param(max_msg_size, int, S_IRUGO);
+MODULE_PARM_DESC(max_msg_size, "absolute upper limit of the message size in bytes");
+
+int default_msg_size = INIT_MESSAGE_SIZE;
+module_param(default_msg_size, int, S_IRUGO);
+MODULE_PARM_DESC(default_msg_size, "message size of a new I/O session in bytes");
+
+int slot_budget = INIT_MESSAGE_SIZE*MAX_SLOT_SIZE;
+module_param(slot_budget, int, S_IRUGO);
+MODULE_PARM_DESC(slot_budget, "bytes of messages a new mailslot may hold");
+
+int max_slot_budget = 64 << 20;
+module_param(max_slot_budget, int, S_IRUGO);
+MODULE_PARM_DESC(max_slot_budget, "absolute upper limit of the budget of a mailslot in bytes");
+
+long total_budget = 0;
+module_param(total_budget, long, S_IRUGO);
+MODULE_PARM_DESC(total_budget, "upper limit of the sum of the budgets of all the mailslots in bytes (the ring size for a ring mailslot), 0 means no limit");
+
+//CHANGE_SPILL, the directory has to exist already
+char* spill_dir = "";
+module_param(spill_dir, charp, S_IRUGO);
+MODULE_PARM_DESC(spill_dir, "directory of the spill logs of the mailslots, empty means no spilling");
+
+long spill_max = 1L << 30;
+module_param(spill_max, long, S_IRUGO);
+MODULE_PARM_DESC(spill_max, "upper limit of the size of a spill log in bytes");
+
+
+//take the slot lock counting the times somebody else holds it
+void slot_lock(slot_elem* elem){
+  if ( spin_trylock( &(elem->queue_lock) ) ) return;
+  this_cpu_inc(elem->stats->contended);
+  spin_lock( &(elem->queue_lock) );
+}
+
+
+//release the slot lock, the messages dropped or expired meanwhile are freed out of it
+void slot_unlock(slot_elem* elem){
+  message *msg, *dropped = elem->dropped;
+  if ( dropped != NULL ) elem->dropped = NULL;
+  spin_unlock( &(elem->queue_lock) );
+  while ( dropped != NULL ){
+    msg = dropped;
+    dropped = msg->next;
+    free_message(elem, msg);
+  }
+}
+
+
+static void stat_hist(u64 __percpu* hist, u64 ns){
+  this_cpu_inc(*(hist + min_t(int, fls64(ns), HIST_BUCKETS - 1)));
+}
+
+
+//every enqueue and dequeue is counted and traced, the depth is computed only when the event is enabled
+void stat_in(slot_elem* elem, size_t len){
+  this_cpu_inc(elem->stats->msgs_in);
+  this_cpu_add(elem->stats->bytes_in, len);
+  if ( trace_lms_enqueue_enabled() ) trace_lms_enqueue(elem->minor, len, slot_depth(elem));
+}
+
+
+//stamp is the enqueue time of the message, 0 when unknown
+void stat_out(slot_elem* elem, size_t len, u64 stamp){
+  this_cpu_inc(elem->stats->msgs_out);
+  this_cpu_add(elem->stats->bytes_out, len);
+  if ( stamp != 0 ) stat_hist(elem->stats->latency, ktime_get_ns() - stamp);
+  if ( trace_lms_dequeue_enabled() ) trace_lms_dequeue(elem->minor, len, slot_depth(elem));
+}
+
+
+//a read or a write of size bytes failed with err
+void stat_reject(slot_elem* elem, size_t size, int err){
+  if ( trace_lms_reject_enabled() ) trace_lms_reject(elem->minor, size, slot_depth(elem), err);
+}
+
+
+//a message was pushed: wake exactly one blocked reader, in FIFO order, and every poller.
+//the wait queue lock is not even touched when nobody sleeps, the full barrier of wq_has_sleeper
+//pairs with the one of a task queueing itself before checking the slot
+void notify_readers(slot_elem* elem){
+  if ( wq_has_sleeper(&elem->readers) ) wake_up_interruptible_poll(&elem->readers, EPOLLIN | EPOLLRDNORM);
+  else this_cpu_inc(elem->stats->wakeups_skipped);
+}
+
+
+//space was given back: wake exactly one blocked writer, in FIFO order, and every poller
+void notify_writers(slot_elem* elem){
+  if ( wq_has_sleeper(&elem->writers) ) wake_up_interruptible_poll(&elem->writers, EPOLLOUT | EPOLLWRNORM);
+  else this_cpu_inc(elem->stats->wakeups_skipped);
+}
+
+
+//an exclusive wakeup reaches a single waiter, after a read (or a write) it is handed over
+//to the next one as long as there is still something for it, called with queue_lock held
+void pass_on_readers(slot_elem* elem){
+  if ( !slot_empty(elem) && wq_has_sleeper(&elem->readers) ) wake_up_interruptible_poll(&elem->readers, EPOLLIN | EPOLLRDNORM);
+}
+
+
+void pass_on_writers(slot_elem* elem){
+  if ( slot_free(elem) > 0 && wq_has_sleeper(&elem->writers) ) wake_up_interruptible_poll(&elem->writers, EPOLLOUT | EPOLLWRNORM);
+}
+
+
+//effective blocking mode of a session, O_NONBLOCK (from open or fcntl) always wins
+int session_blocking(session* s){
+  if ( s->filp->f_flags & O_NONBLOCK ) return NON_BLOCKING;
+  return READ_ONCE(s->blocking);
+}
+
+
+//jiffies a read (or a write) of the session may sleep, 0 in non blocking mode
+long session_timeout(session* s, int writer){
+  const unsigned int ms = writer ? READ_ONCE(s->w_timeout) : READ_ONCE(s->r_timeout);
+  if ( session_blocking(s) == NON_BLOCKING ) return 0;
+  return ( ms == 0 ) ? MAX_SCHEDULE_TIMEOUT : msecs_to_jiffies(ms);
+}
+
+
+//nothing to read for the session, checked without the lock
+static int session_idle(session* s){
+  if ( READ_ONCE(s->slot->storage) == STORAGE_BROADCAST ) return !bcast_ready(s);
+  return slot_empty(s->slot);
+}
+
+
+//like SO_BUSY_POLL: a blocking reader that finds the slot empty spins on it without the lock for
+//up to busy_poll us, so that a message arriving meanwhile costs neither a wakeup nor a schedule.
+//the caller takes the lock and checks again in any case, it is only a hint
+void session_busy_poll(session* s){
+
+  const unsigned int us = READ_ONCE(s->busy_poll);
+  u64 end;
+
+  if ( us == 0 || session_timeout(s, NO) == 0 || !session_idle(s) ) return;
+  end = ktime_get_ns() + (u64) us * NSEC_PER_USEC;
+  do {
+    cpu_relax();
+    if ( !session_idle(s) ){
+      this_cpu_inc(s->slot->stats->spin_hits);
+      return;
+    }
+  } while ( ktime_get_ns() < end && !need_resched() );
+  this_cpu_inc(s->slot->stats->spin_misses);
+}
+
+
+static int size_class(size_t len){
+  int cls = 0;
+  while ( cls < LARGE_CLASS && (MIN_CLASS_SIZE << cls) < len ) cls++;
+  return cls;
+}
+
+
+//payload of a large message, one page at a time
+static message* alloc_large_message(size_t len, int node){
+
+  const u32 nr_pages = DIV_ROUND_UP(len, PAGE_SIZE);
+  message* msg = kvmalloc_node( sizeof(message) + nr_pages * sizeof(struct page*), GFP_KERNEL, node );
+  if ( msg == NULL ) return NULL;
+  msg->pages = (struct page**) msg->payload;
+  for ( msg->nr_pages = 0 ; msg->nr_pages < nr_pages ; msg->nr_pages++ ){
+    msg->pages[msg->nr_pages] = alloc_pages_node(node, GFP_KERNEL, 0);
+    if ( msg->pages[msg->nr_pages] == NULL ){
+      while ( msg->nr_pages > 0 ) __free_page( msg->pages[--msg->nr_pages] );
+      kvfree(msg);
+      return NULL;
+    }
+  }
+  return msg;
+}
+
+
+static void free_large_message(message* msg){
+  u32 i;
+  for ( i = 0 ; i < msg->nr_pages ; i++ ) __free_page( msg->pages[i] );
+  kvfree(msg);
+}
+
+
+//the allocators fall back to other nodes when the wanted one is short of memory
+static void stat_node(slot_elem* elem, message* msg, int node){
+  struct page* page = ( msg->size_class == LARGE_CLASS ) ? msg->pages[0] : virt_to_page(msg);
+  if ( node == NUMA_NO_NODE ) node = numa_node_id();
+  if ( page_to_nid(page) == node ) this_cpu_inc(elem->stats->alloc_local);
+  else this_cpu_inc(elem->stats->alloc_remote);
+}
+
+
+message* alloc_message(slot_elem* elem, size_t len){
+
+  message* msg = NULL;
+  const int cls = size_class(len);
+  const int node = READ_ONCE(elem->node);
+
+  //fast path: the slot reserve, any object at least as big as the message fits
+  if ( cls <= elem->pool_class && cls != LARGE_CLASS ){
+    spin_lock( &(elem->pool_lock) );
+    if ( elem->pool != NULL ){
+      msg = elem->pool;
+      elem->pool = msg->next;
+      elem->pool_count--;
+    }
+    spin_unlock( &(elem->pool_lock) );
+    if ( msg != NULL ){
+      atomic_long_inc( &alloc_stats.pool_hits );
+      msg->next = NULL;
+      return msg;
+    }
+  }
+
+  //slow path: the slab cache of the size class
+  if ( cls == LARGE_CLASS ) msg = alloc_large_message(len, node);
+  else msg = kmem_cache_alloc_node( msg_caches[cls], GFP_KERNEL, node );
+  if ( msg == NULL ){
+    atomic_long_inc( &alloc_stats.alloc_failures );
+    return NULL;
+  }
+  atomic_long_inc( &alloc_stats.slab_allocs );
+  msg->size_class = cls;
+  msg->next = NULL;
+  stat_node(elem, msg, node);
+  return msg;
+}
+
+
+void free_message(slot_elem* elem, message* msg){
+
+  //refill the slot reserve first, then give the object back to its cache
+  if ( msg->size_class == elem->pool_class && msg->size_class != LARGE_CLASS ){
+    spin_lock( &(elem->pool_lock) );
+    if ( elem->pool_count < slot_reserve ){
+      msg->next = elem->pool;
+      elem->pool = msg;
+      elem->pool_count++;
+      spin_unlock( &(elem->pool_lock) );
+      atomic_long_inc( &alloc_stats.pool_frees );
+      return;
+    }
+    spin_unlock( &(elem->pool_lock) );
+  }
+  if ( msg->size_class == LARGE_CLASS ) free_large_message(msg);
+  else kmem_cache_free( msg_caches[msg->size_class], msg );
+  atomic_long_inc( &alloc_stats.slab_frees );
+}
+
+
+//payload copies, page by page for the large messages
+static int msg_copy_from_iter(message* msg, size_t len, struct iov_iter* from){
+  size_t done, chunk;
+  u32 i;
+  if ( msg->size_class != LARGE_CLASS ) return copy_from_iter(msg->payload, len, from) == len ? SUCCESS : FAILURE;
+  for ( i = 0, done = 0 ; done < len ; i++, done += chunk ){
+    chunk = min_t(size_t, len - done, PAGE_SIZE);
+    if ( copy_page_from_iter(msg->pages[i], 0, chunk, from) != chunk ) return FAILURE;
+  }
+  return SUCCESS;
+}
+
+
+static int msg_copy_to_iter(message* msg, struct iov_iter* to){
+  size_t done, chunk;
+  u32 i;
+  if ( msg->size_class != LARGE_CLASS ) return copy_to_iter(msg->payload, msg->size, to) == msg->size ? SUCCESS : FAILURE;
+  for ( i = 0, done = 0 ; done < msg->size ; i++, done += chunk ){
+    chunk = min_t(size_t, msg->size - done, PAGE_SIZE);
+    if ( copy_page_to_iter(msg->pages[i], 0, chunk, to) != chunk ) return FAILURE;
+  }
+  return SUCCESS;
+}
+
+
+int msg_copy_from_user(message* msg, const char __user* buff, size_t len){
+  size_t done, chunk;
+  u32 i;
+  if ( msg->size_class != LARGE_CLASS ) return copy_from_user(msg->payload, buff, len) == 0 ? SUCCESS : FAILURE;
+  for ( i = 0, done = 0 ; done < len ; i++, done += chunk ){
+    chunk = min_t(size_t, len - done, PAGE_SIZE);
+    if ( copy_from_user(page_address(msg->pages[i]), buff + done, chunk) != 0 ) return FAILURE;
+  }
+  return SUCCESS;
+}
+
+
+int msg_copy_to_user(message* msg, char __user* buff){
+  size_t done, chunk;
+  u32 i;
+  if ( msg->size_class != LARGE_CLASS ) return copy_to_user(buff, msg->payload, msg->size) == 0 ? SUCCESS : FAILURE;
+  for ( i = 0, done = 0 ; done < msg->size ; i++, done += chunk ){
+    chunk = min_t(size_t, msg->size - done, PAGE_SIZE);
+    if ( copy_to_user(buff + done, page_address(msg->pages[i]), chunk) != 0 ) return FAILURE;
+  }
+  return SUCCESS;
+}
+
+
+//into a kernel buffer, called under queue_lock
+static void msg_copy_out(message* msg, char* buf){
+  size_t done, chunk;
+  u32 i;
+  if ( msg->size_class != LARGE_CLASS ){
+    memcpy(buf, msg->payload, msg->size);
+    return;
+  }
+  for ( i = 0, done = 0 ; done < msg->size ; i++, done += chunk ){
+    chunk = min_t(size_t, msg->size - done, PAGE_SIZE);
+    memcpy(buf + done, page_address(msg->pages[i]), chunk);
+  }
+}
+
+
+static void fill_pool(slot_elem* elem){
+  message* msg;
+  //only slab classes are kept in reserve
+  if ( elem->pool_class == LARGE_CLASS ) return;
+  while ( elem->pool_count < slot_reserve ){
+    msg = kmem_cache_alloc_node( msg_caches[elem->pool_class], GFP_KERNEL, elem->node );
+    if ( msg == NULL ){
+      pr_debug_ratelimited("%s: cannot preallocate the message reserve, %d messages available\n", MODNAME, elem->pool_count);
+      return;
+    }
+    msg->size_class = elem->pool_class;
+    msg->next = elem->pool;
+    elem->pool = msg;
+    elem->pool_count++;
+  }
+}
+
+
+static void drain_pool(slot_elem* elem){
+  message* msg;
+  while ( elem->pool != NULL ){
+    msg = elem->pool;
+    elem->pool = msg->next;
+    kmem_cache_free( msg_caches[msg->size_class], msg );
+  }
+  elem->pool_count = 0;
+}
+
+
+/*
+space accounting of every storage but the ring: a writer reserves the bytes of its message on
+free_mem before linking it (reserve), lock free, then links the message (commit) or gives the
+bytes back (cancel). the bytes of a linked message go back exactly once, at the single point where
+it is unlinked from its storage (pop_level, bcast_unlink, lf_pop), whether it is read, dropped,
+expired or forwarded. a list read keeps them while it copies the messages out (unlink_level), a
+copy that fails links the messages back with their bytes still taken. a ring slot keeps free_mem at SPACE_CLOSED so that no reservation succeeds,
+and a storage switch closes it only when free_mem is the whole budget: nothing linked or in flight
+*/
+int space_reserve(slot_elem* elem, int len){
+  int free = atomic_read(&elem->free_mem);
+  do {
+    if ( free < len ) return NO;
+  } while ( !atomic_try_cmpxchg(&elem->free_mem, &free, free - len) );
+  return YES;
+}
+
+
+void space_cancel(slot_elem* elem, int len){
+  atomic_add(len, &elem->free_mem);
+}
+
+
+static void space_commit(slot_elem* elem){
+  atomic_inc(&elem->msgs);
+}
+
+
+static void space_release(slot_elem* elem, int len){
+  atomic_dec(&elem->msgs);
+  atomic_add(len, &elem->free_mem);
+}
+
+
+//forbid new reservations, only possible when no message is linked or in flight
+static int space_close(slot_elem* elem){
+  if ( elem->storage == STORAGE_RING ) return YES;
+  return atomic_cmpxchg(&elem->free_mem, elem->budget, SPACE_CLOSED) == elem->budget;
+}
+
+
+//the message is already allocated, filled and its space reserved, here it is only linked,
+//called with queue_lock held
+void push_message(slot_elem* elem, message* msg, int prio){
+
+  space_commit(elem);
+  msg->next = NULL;
+  msg->prio = prio;
+  if( elem->head[prio] == NULL ) {
+    //empty message queue
+    elem->head[prio] = msg;
+    elem->tail[prio] = msg;
+    __set_bit(prio, &elem->prio_map);
+  }
+  else {
+    //push the message to the tail of the message queue
+    elem->tail[prio]->next = msg;
+    elem->tail[prio] = msg;
+  }
+}
+
+
+//next message to be read: the head of the highest non empty level, called with queue_lock held
+message* slot_head(slot_elem* elem){
+  if ( elem->prio_map == 0 ) return NULL;
+  return elem->head[__fls(elem->prio_map)];
+}
+
+
+//unlink the head message of level prio, its space is still taken, called with queue_lock held
+static message* unlink_level(slot_elem* elem, int prio){
+
+  message* head_aux = elem->head[prio];
+  elem->head[prio] = head_aux->next; //pop the readed message
+  if ( elem->head[prio] == NULL ){
+    elem->tail[prio] = NULL;
+    __clear_bit(prio, &elem->prio_map);
+  }
+  return head_aux;
+}
+
+
+//unlink the head message of level prio and give its space back to the slot, called with queue_lock held
+static message* pop_level(slot_elem* elem, int prio){
+
+  message* head_aux = unlink_level(elem, prio);
+  space_release(elem, head_aux->size);
+  return head_aux;
+}
+
+
+//link back at the head of their levels the messages of a read that could not copy them out,
+//chain is in read order and its space is still taken, called with queue_lock held
+static void relink_messages(slot_elem* elem, message* chain){
+
+  message *msg, *rev = NULL;
+
+  //the last message read goes back first so that the first one ends up at the head again
+  while ( chain != NULL ){
+    msg = chain;
+    chain = chain->next;
+    msg->next = rev;
+    rev = msg;
+  }
+  while ( rev != NULL ){
+    msg = rev;
+    rev = rev->next;
+    msg->next = elem->head[msg->prio];
+    if ( msg->next == NULL ){
+      elem->tail[msg->prio] = msg;
+      __set_bit(msg->prio, &elem->prio_map);
+    }
+    elem->head[msg->prio] = msg;
+  }
+}
+
+
+//unlink the message a read takes, called with queue_lock held
+//the caller copies the payload out after releasing the lock and then frees the message
+message* pop_message(slot_elem* elem){
+  return pop_level(elem, __fls(elem->prio_map));
+}
+
+
+//queue a filled message in a lock free slot, NOT_ENOUGH_SPACE_ERROR when the budget or the cells are exhausted
+static int lf_push(slot_elem* elem, message* msg){
+
+  lf_queue* q = &(elem->lf);
+  lf_cell *cells, *cell = NULL;
+  int pos, dif, ret = NOT_ENOUGH_SPACE_ERROR;
+
+  if ( !space_reserve(elem, msg->size) ) return NOT_ENOUGH_SPACE_ERROR;
+  rcu_read_lock();
+  cells = rcu_dereference(q->cells);
+  pos = atomic_read(&q->enq);
+  while ( cells != NULL ){
+    cell = &cells[pos & (LF_CELLS - 1)];
+    dif = atomic_read_acquire(&cell->seq) - pos;
+    if ( dif == 0 ){
+      //the cell is free for this lap, take its position
+      if ( atomic_try_cmpxchg(&q->enq, &pos, pos + 1) ){
+        ret = SUCCESS;
+        break;
+      }
+    }
+    else if ( dif < 0 ) break; //every cell holds a message
+    //the mode changed under us, the counters were reset and this lap never ends
+    else if ( rcu_dereference(q->cells) != cells ) break;
+    else pos = atomic_read(&q->enq);
+  }
+  if ( ret == SUCCESS ){
+    cell->msg = msg;
+    cell->size = msg->size;
+    //counted before a reader can take it
+    space_commit(elem);
+    //the message has to be visible before the cell is marked as full
+    atomic_set_release(&cell->seq, pos + 1);
+  }
+  rcu_read_unlock();
+  if ( ret != SUCCESS ) space_cancel(elem, msg->size);
+  return ret;
+}
+
+
+//take the first message of a lock free slot if it is at most room bytes long
+//FAILURE when the slot is empty, MSREAD_ERROR when the message does not fit and stays queued
+static int lf_pop(slot_elem* elem, size_t room, message** out){
+
+  lf_queue* q = &(elem->lf);
+  lf_cell *cells, *cell = NULL;
+  int pos, dif, ret = FAILURE;
+
+  rcu_read_lock();
+  cells = rcu_dereference(q->cells);
+  pos = atomic_read(&q->deq);
+  while ( cells != NULL ){
+    cell = &cells[pos & (LF_CELLS - 1)];
+    dif = atomic_read_acquire(&cell->seq) - (pos + 1);
+    if ( dif == 0 ){
+      //the size is valid as long as deq did not move, the cmpxchg tells
+      if ( READ_ONCE(cell->size) > room ){
+        ret = MSREAD_ERROR;
+        break;
+      }
+      if ( atomic_try_cmpxchg(&q->deq, &pos, pos + 1) ){
+        ret = SUCCESS;
+        break;
+      }
+    }
+    else if ( dif < 0 ) break; //empty, or the first message is still being written
+    //the mode changed under us
+    else if ( rcu_dereference(q->cells) != cells ) break;
+    else pos = atomic_read(&q->deq);
+  }
+  if ( ret == SUCCESS ){
+    *out = cell->msg;
+    //free the cell for the next lap
+    atomic_set_release(&cell->seq, pos + LF_CELLS);
+  }
+  rcu_read_unlock();
+  if ( ret == SUCCESS ) space_release(elem, (*out)->size);
+  return ret;
+}
+
+
+//whether the first message of a lock free slot is there, and its size
+static int lf_peek(lf_queue* q, u32* size){
+  lf_cell* cells;
+  int pos, ready = NO;
+  rcu_read_lock();
+  cells = rcu_dereference(q->cells);
+  if ( cells != NULL ){
+    pos = atomic_read(&q->deq);
+    ready = atomic_read_acquire(&cells[pos & (LF_CELLS - 1)].seq) == pos + 1;
+    if ( ready ) *size = READ_ONCE(cells[pos & (LF_CELLS - 1)].size);
+  }
+  rcu_read_unlock();
+  return ready;
+}
+
+
+static int lf_ready(lf_queue* q){
+  u32 size;
+  return lf_peek(q, &size);
+}
+
+
+static int lf_full(lf_queue* q){
+  return atomic_read(&q->enq) - atomic_read(&q->deq) >= LF_CELLS;
+}
+
+
+//broadcast storage, drop a reference to a message: the last one queues it for slot_unlock
+//called with queue_lock held
+static void bcast_put(slot_elem* elem, message* msg){
+  if ( --msg->refs > 0 ) return;
+  msg->next = elem->dropped;
+  elem->dropped = msg;
+}
+
+
+//the oldest message leaves the ring, subscribers that did not read it yet will skip it
+static void bcast_unlink(slot_elem* elem){
+  bcast* bc = &(elem->bcast);
+  message* msg = bc->msgs[bc->head & (BCAST_CELLS - 1)];
+  bc->head++;
+  space_release(elem, msg->size);
+  bcast_put(elem, msg);
+}
+
+
+//the messages read by every subscriber leave the ring, they do it in order because a subscriber
+//reads in order and one that goes away drops all the messages it did not read
+static void bcast_trim(slot_elem* elem){
+  bcast* bc = &(elem->bcast);
+  int trimmed = NO;
+  while ( bc->head != bc->tail && bc->msgs[bc->head & (BCAST_CELLS - 1)]->pending == 0 ){
+    bcast_unlink(elem);
+    trimmed = YES;
+  }
+  if ( trimmed ) notify_writers(elem);
+}
+
+
+//store a message once for all the subscribers and wake every one of them, called with queue_lock held
+static void bcast_push(slot_elem* elem, message* msg){
+  bcast* bc = &(elem->bcast);
+  msg->refs = 1;
+  msg->pending = bc->subscribers;
+  bc->msgs[bc->tail & (BCAST_CELLS - 1)] = msg;
+  bc->tail++;
+  space_commit(elem);
+  //nobody to read it, it leaves at once
+  bcast_trim(elem);
+  if ( wq_has_sleeper(&elem->readers) ) wake_up_interruptible_all(&elem->readers);
+  else this_cpu_inc(elem->stats->wakeups_skipped);
+}
+
+
+static int bcast_subscribed(session* s){
+  return s->slot->storage == STORAGE_BROADCAST && s->bcast_gen == s->slot->bcast.gen;
+}
+
+
+//a new subscriber starts from the next message written, called with queue_lock held
+static void bcast_join(session* s){
+  bcast* bc = &(s->slot->bcast);
+  if ( s->slot->storage != STORAGE_BROADCAST || bcast_subscribed(s) ) return;
+  s->cursor = bc->tail;
+  s->bcast_gen = bc->gen;
+  bc->subscribers++;
+}
+
+
+void bcast_subscribe(session* s){
+  slot_lock(s->slot);
+  bcast_join(s);
+  spin_unlock( &(s->slot->queue_lock) );
+}
+
+
+//the messages the session did not read do not wait for it anymore
+void bcast_unsubscribe(session* s){
+
+  slot_elem* elem = s->slot;
+  bcast* bc = &(elem->bcast);
+  u64 seq;
+
+  slot_lock(elem);
+  if ( bcast_subscribed(s) ){
+    for ( seq = max(s->cursor, bc->head) ; seq != bc->tail ; seq++ ) bc->msgs[seq & (BCAST_CELLS - 1)]->pending--;
+    bc->subscribers--;
+    s->bcast_gen = 0;
+    bcast_trim(elem);
+  }
+  slot_unlock(elem);
+}
+
+
+//whether a read of a subscriber would not wait, lockless for poll and for the wait condition.
+//a slot that left the broadcast storage has to be read through the new one
+int bcast_ready(session* s){
+  slot_elem* elem = s->slot;
+  return READ_ONCE(elem->storage) != STORAGE_BROADCAST || READ_ONCE(elem->bcast.tail) != READ_ONCE(s->cursor);
+}
+
+
+int slot_empty(slot_elem* elem){
+  if ( elem->storage == STORAGE_LOCKFREE ) return !lf_ready(&elem->lf);
+  if ( elem->storage == STORAGE_BROADCAST ) return elem->bcast.head == elem->bcast.tail;
+  if ( elem->storage == STORAGE_RING ) return READ_ONCE(elem->ring.ctrl->head) == smp_load_acquire(&elem->ring.ctrl->tail);
+  return elem->prio_map == 0;
+}
+
+
+//free bytes of the slot, the ring indexes may be moved from user space so they are read each time
+int slot_free(slot_elem* elem){
+  if ( elem->storage == STORAGE_LOCKFREE && lf_full(&elem->lf) ) return 0;
+  if ( elem->storage == STORAGE_BROADCAST && elem->bcast.tail - elem->bcast.head >= BCAST_CELLS ) return 0;
+  if ( elem->storage == STORAGE_RING ) return elem->ring.size - (READ_ONCE(elem->ring.ctrl->tail) - READ_ONCE(elem->ring.ctrl->head));
+  return max(atomic_read(&elem->free_mem), 0);
+}
+
+
+//whether a message of needed bytes fits, called with queue_lock held. the list and broadcast
+//storages reserve its space at once, lock free writers reserve it in lf_push
+static int slot_claim(slot_elem* elem, int needed){
+  switch ( elem->storage ){
+    case STORAGE_LIST:
+      return space_reserve(elem, needed);
+    case STORAGE_BROADCAST:
+      return slot_free(elem) > 0 && space_reserve(elem, needed);
+    default:
+      return slot_free(elem) >= needed;
+  }
+}
+
+
+//undo a successful make_room (or wait_for_space) whose message will not be linked, called with queue_lock held
+void slot_unclaim(slot_elem* elem, int needed){
+  if ( elem->storage == STORAGE_LIST || elem->storage == STORAGE_BROADCAST ) space_cancel(elem, needed);
+}
+
+
+//queued bytes
+int slot_depth(slot_elem* elem){
+  const int capacity = ( elem->storage == STORAGE_RING ) ? elem->ring.size : elem->budget;
+  return capacity - slot_free(elem);
+}
+
+
+//high water mark after an enqueue, the racy maximum is good enough for statistics
+void stat_depth(slot_elem* elem){
+  const int used = slot_depth(elem);
+  if ( used > READ_ONCE(elem->hwm) ) WRITE_ONCE(elem->hwm, used);
+}
+
+
+//keep the sleepers count of the shared control page up to date, user space producers
+//and consumers enter the kernel to wake someone up only when it is not zero
+void ring_sleepers(slot_elem* elem, int readers, int writers){
+  if ( elem->storage != STORAGE_RING ) return;
+  elem->ring.readers_waiting += readers;
+  elem->ring.writers_waiting += writers;
+  WRITE_ONCE(elem->ring.ctrl->readers_waiting, elem->ring.readers_waiting | (elem->ring.polled ? LMS_RING_POLLED : 0));
+  WRITE_ONCE(elem->ring.ctrl->writers_waiting, elem->ring.writers_waiting | (elem->ring.polled ? LMS_RING_POLLED : 0));
+  smp_mb();
+}
+
+
+static int msg_expired(slot_elem* elem, message* msg, u64 now){
+  const u64 ttl = READ_ONCE(elem->ttl);
+  return ttl != 0 && now - msg->stamp > ttl;
+}
+
+
+//the messages of a level (or of the broadcast ring) are in enqueue order, so only the heads need a check
+//called with queue_lock held
+static void expire_messages(slot_elem* elem){
+
+  unsigned long map = elem->prio_map;
+  message* msg;
+  u64 now;
+  int prio, expired = 0;
+
+  if ( READ_ONCE(elem->ttl) == 0 ) return;
+  now = ktime_get_ns();
+  while ( elem->storage == STORAGE_BROADCAST && !slot_empty(elem) && msg_expired(elem, elem->bcast.msgs[elem->bcast.head & (BCAST_CELLS - 1)], now) ){
+    bcast_unlink(elem);
+    expired++;
+  }
+  if ( elem->storage != STORAGE_LIST ) map = 0;
+  while ( map != 0 ){
+    prio = __fls(map);
+    __clear_bit(prio, &map);
+    while ( elem->head[prio] != NULL && msg_expired(elem, elem->head[prio], now) ){
+      msg = pop_level(elem, prio);
+      msg->next = elem->dropped;
+      elem->dropped = msg;
+      expired++;
+    }
+  }
+  if ( expired == 0 ) return;
+  this_cpu_add(elem->stats->expired, expired);
+  notify_writers(elem);
+}
+
+
+//LMS_OVERFLOW_DROP_OLDEST victim, the oldest message of the lowest non empty level, called with queue_lock held
+static int drop_oldest(slot_elem* elem){
+
+  message* msg;
+  if ( elem->storage == STORAGE_BROADCAST ){
+    if ( slot_empty(elem) ) return NO;
+    bcast_unlink(elem);
+    this_cpu_inc(elem->stats->dropped);
+    return YES;
+  }
+  if ( elem->storage == STORAGE_LIST && elem->prio_map != 0 ) msg = pop_level(elem, __ffs(elem->prio_map));
+  else if ( elem->storage != STORAGE_LOCKFREE || lf_pop(elem, SIZE_MAX, &msg) != SUCCESS ) return NO;
+  msg->next = elem->dropped;
+  elem->dropped = msg;
+  this_cpu_inc(elem->stats->dropped);
+  return YES;
+}
+
+
+//wait until the slot has at least needed free bytes, for timeout jiffies at most (0 means non blocking)
+//called with queue_lock held, on SUCCESS it returns with the lock held, otherwise the lock is released
+int wait_for_space(slot_elem* elem, int needed, long timeout){
+
+  long ret;
+  u64 start;
+  while( !slot_claim(elem, needed) ){
+    //not enough free space
+    //if in blocking mode then wait else exit
+    if ( timeout == 0 ){
+      stat_reject(elem, needed, NOT_ENOUGH_SPACE_ERROR);
+      spin_unlock( &(elem->queue_lock) );
+      this_cpu_inc(elem->stats->eagain);
+      return NOT_ENOUGH_SPACE_ERROR;
+    }
+    ring_sleepers(elem, 0, 1);
+
+    //release the lock and wait for the event, a reader wakes up the first writer in the queue
+    spin_unlock( &(elem->queue_lock) );
+    this_cpu_inc(elem->stats->blocked_writers);
+    if ( trace_lms_block_enabled() ) trace_lms_block(elem->minor, needed, slot_depth(elem), YES);
+    start = ktime_get_ns();
+    ret = wait_event_interruptible_exclusive_timeout(elem->writers, slot_free(elem) >= needed, timeout);
+    stat_hist(elem->stats->sleep, ktime_get_ns() - start);
+    if ( trace_lms_wake_enabled() ) trace_lms_wake(elem->minor, needed, slot_depth(elem), YES);
+
+    slot_lock(elem);
+    ring_sleepers(elem, 0, -1);
+    if ( ret <= 0 ){
+      /*the function will return -ERESTARTSYS if it was interrupted by a signal, 0 if the time is over
+      and the jiffies left if condition evaluated to true.*/
+      //the wakeup may have been meant for us, do not lose it
+      pass_on_writers(elem);
+      spin_unlock( &(elem->queue_lock) );
+      if ( ret == 0 ){
+        stat_reject(elem, needed, TIMEOUT_ERROR);
+        return TIMEOUT_ERROR;
+      }
+      pr_debug_ratelimited("%s: The process [writer] %d has been awaken by a signal\n", MODNAME , current->pid);
+      return FAILURE;
+    }
+    //the space may be gone again, the next sleep gets the time left
+    timeout = ret;
+  }
+  return SUCCESS;
+}
+
+
+//wait until the slot holds at least a message, for timeout jiffies at most (0 means non blocking)
+//called with queue_lock held, on SUCCESS it returns with the lock held, otherwise the lock is released
+int wait_for_message(slot_elem* elem, long timeout){
+
+  long ret;
+  u64 start;
+  expire_messages(elem);
+  while( slot_empty(elem) ){
+    //no messages to read!
+    if ( timeout == 0 ){
+      //quit
+      stat_reject(elem, 0, FAILURE);
+      slot_unlock(elem);
+      this_cpu_inc(elem->stats->eagain);
+      return FAILURE;
+    }
+    ring_sleepers(elem, 1, 0);
+    //release the lock and wait for the event, a writer wakes up the first reader in the queue
+    slot_unlock(elem);
+    this_cpu_inc(elem->stats->blocked_readers);
+    if ( trace_lms_block_enabled() ) trace_lms_block(elem->minor, 0, slot_depth(elem), NO);
+    start = ktime_get_ns();
+    ret = wait_event_interruptible_exclusive_timeout(elem->readers, !slot_empty(elem), timeout);
+    stat_hist(elem->stats->sleep, ktime_get_ns() - start);
+    if ( trace_lms_wake_enabled() ) trace_lms_wake(elem->minor, 0, slot_depth(elem), NO);
+
+    slot_lock(elem);
+    ring_sleepers(elem, -1, 0);
+    if ( ret <= 0 ){
+      /*the function will return -ERESTARTSYS if it was interrupted by a signal, 0 if the time is over
+      and the jiffies left if condition evaluated to true.*/
+      //the wakeup may have been meant for us, do not lose it
+      pass_on_readers(elem);
+      slot_unlock(elem);
+      if ( ret == 0 ){
+        stat_reject(elem, 0, TIMEOUT_ERROR);
+        return TIMEOUT_ERROR;
+      }
+      pr_debug_ratelimited("%s: The process [read] %d has been awaken by a signal\n", MODNAME , current->pid);
+      return FAILURE;
+    }
+    //a racing reader may take the message first, the next sleep gets the time left
+    timeout = ret;
+    expire_messages(elem);
+  }
+  return SUCCESS;
+}
+
+
+//apply the overflow policy of the slot to a write of needed bytes
+//called with queue_lock held, on SUCCESS it returns with the lock held, otherwise the lock is released
+//MSG_DROPPED means the message of the write has to be discarded
+//on SUCCESS a list or broadcast slot holds the space reserved (slot_claim), the caller links the
+//message or cancels the reservation
+int make_room(slot_elem* elem, int needed, long timeout){
+
+  int fits;
+  switch ( READ_ONCE(elem->overflow) ){
+    case LMS_OVERFLOW_REJECT:
+      return wait_for_space(elem, needed, 0);
+    case LMS_OVERFLOW_DROP_OLDEST:
+      //a message bigger than the budget would empty the slot for nothing
+      while ( !(fits = slot_claim(elem, needed)) && needed <= elem->budget && drop_oldest(elem) );
+      break;
+    case LMS_OVERFLOW_DROP_NEWEST:
+      fits = slot_claim(elem, needed);
+      break;
+    default:
+      return wait_for_space(elem, needed, timeout);
+  }
+  if ( fits ) return SUCCESS;
+  this_cpu_inc(elem->stats->dropped);
+  slot_unlock(elem);
+  return MSG_DROPPED;
+}
+
+
+//copy len bytes at the free running offset pos of the ring, the range may wrap around the end
+static int ring_copy_from_iter(ring* r, u32 pos, struct iov_iter* from, size_t len){
+  const u32 off = pos & (r->size - 1);
+  const u32 first = min_t(u32, len, r->size - off);
+  if ( copy_from_iter(r->data + off, first, from) != first ) return FAILURE;
+  if ( first < len && copy_from_iter(r->data, len - first, from) != len - first ) return FAILURE;
+  return SUCCESS;
+}
+
+
+static int ring_copy_to_iter(ring* r, u32 pos, struct iov_iter* to, size_t len){
+  const u32 off = pos & (r->size - 1);
+  const u32 first = min_t(u32, len, r->size - off);
+  if ( copy_to_iter(r->data + off, first, to) != first ) return FAILURE;
+  if ( first < len && copy_to_iter(r->data, len - first, to) != len - first ) return FAILURE;
+  return SUCCESS;
+}
+
+
+//room for the next message of a batch read: a whole iovec segment, or what is left of a packed
+//buffer. a read of a single message may span the segments, a record has to fit with its length
+static size_t batch_room(batch* b, struct iov_iter* it){
+  const size_t left = iov_iter_count(it) & ~((size_t) 7);
+  if ( b->count >= b->max_msgs || iov_iter_count(it) == 0 ) return 0;
+  if ( b->records ) return ( left > LMS_RING_HDR_SIZE ) ? left - LMS_RING_HDR_SIZE : 0;
+  return ( b->lens != NULL || b->max_msgs == 1 ) ? iov_iter_count(it) : iov_iter_single_seg_count(it);
+}
+
+
+//the length in front of a record, before its payload is copied
+static int batch_head(batch* b, struct iov_iter* it, size_t size){
+  u32 len = size;
+  if ( b->records && copy_to_iter(&len, LMS_RING_HDR_SIZE, it) != LMS_RING_HDR_SIZE ) return FAILURE;
+  return SUCCESS;
+}
+
+
+//the copy of a message of size bytes in room bytes is done, move to the next destination.
+//a single message read has no next one, the iterator of a splice must not move past its bytes
+static int batch_next(batch* b, struct iov_iter* it, size_t room, size_t size){
+  static const char pad[8];
+  const size_t rec = LMS_RING_RECORD_SIZE(size);
+  if ( b->lens != NULL ) return put_user((u32) size, &b->lens[b->count]) != 0 ? FAILURE : SUCCESS;
+  if ( b->records ){
+    //the padding reaches user space, it must not carry stale bytes
+    if ( copy_to_iter(pad, rec - LMS_RING_HDR_SIZE - size, it) != rec - LMS_RING_HDR_SIZE - size ) return FAILURE;
+    b->bytes += rec;
+    return SUCCESS;
+  }
+  if ( b->max_msgs > 1 ) iov_iter_advance(it, room - size);
+  return SUCCESS;
+}
+
+
+//publish the records written up to pos, called with queue_lock held
+static void ring_publish(slot_elem* elem, u32 pos){
+  if ( pos == READ_ONCE(elem->ring.ctrl->tail) ) return;
+  //the payloads have to be visible before the new tail
+  smp_store_release(&elem->ring.ctrl->tail, pos);
+  notify_readers(elem);
+}
+
+
+//ring storage: the w_mutex holder is the only one moving the tail, so the space it waited for
+//cannot be taken by anyone else while the payloads are copied without the spinlock
+//every iovec segment is one message, records are published together unless the writer has to wait
+static ssize_t ring_write_iter(session* s, struct iov_iter* from, long timeout){
+
+  slot_elem* elem = s->slot;
+  const size_t max_size = READ_ONCE(s->curr_size);
+  int ret = SUCCESS;
+  u32 pos, rec;
+  size_t len;
+  ssize_t done = 0;
+
+  if ( mutex_lock_interruptible( &(elem->w_mutex) ) != 0 ) return FAILURE;
+  slot_lock(elem);
+  if ( elem->storage != STORAGE_RING || elem->ring.producer != NULL ){
+    //the producer side belongs to a user space mapping
+    spin_unlock( &(elem->queue_lock) );
+    mutex_unlock( &(elem->w_mutex) );
+    return FAILURE;
+  }
+  pos = READ_ONCE(elem->ring.ctrl->tail);
+  spin_unlock( &(elem->queue_lock) );
+
+  while ( iov_iter_count(from) > 0 ){
+    len = iov_iter_single_seg_count(from);
+    if ( len == 0 || len > max_size ){
+      stat_reject(elem, len, FAILURE);
+      ret = FAILURE;
+      break;
+    }
+    rec = LMS_RING_RECORD_SIZE(len);
+    if ( elem->ring.size - (pos - READ_ONCE(elem->ring.ctrl->head)) < rec ){
+      //readers need what is ready to make room
+      slot_lock(elem);
+      ring_publish(elem, pos);
+      ret = make_room(elem, rec, timeout);
+      if ( ret == MSG_DROPPED ){
+        iov_iter_advance(from, len);
+        done += len;
+        continue;
+      }
+      if ( ret != SUCCESS ) break;
+      spin_unlock( &(elem->queue_lock) );
+    }
+    if ( ring_copy_from_iter(&elem->ring, pos + LMS_RING_HDR_SIZE, from, len) != SUCCESS ){
+      ret = FAILURE;
+      break;
+    }
+    *(u32*)(elem->ring.data + (pos & (elem->ring.size - 1))) = len;
+    pos += rec;
+    done += len;
+    stat_in(elem, len);
+  }
+
+  slot_lock(elem);
+  ring_publish(elem, pos);
+  stat_depth(elem);
+  spin_unlock( &(elem->queue_lock) );
+  mutex_unlock( &(elem->w_mutex) );
+  return done > 0 ? done : ret;
+}
+
+
+//whether a record of len bytes at pos can be right: a user space producer may write any length prefix,
+//the record has to fit the ring and the bytes published before tail
+static int ring_record_valid(slot_elem* elem, u32 pos, u32 tail, u32 len){
+  return len <= elem->ring.size - LMS_RING_HDR_SIZE && LMS_RING_RECORD_SIZE(len) <= tail - pos;
+}
+
+
+//take the records available once the first one is there, as long as they fit the batch layout.
+//a malformed record drops everything published, otherwise it would stop every read after it
+static ssize_t ring_read_iter(session* s, struct iov_iter* to, batch* b){
+
+  slot_elem* elem = s->slot;
+  int ret;
+  u32 head, tail, pos, msg_len;
+  size_t room;
+  ssize_t done = 0;
+
+  if ( mutex_lock_interruptible( &(elem->r_mutex) ) != 0 ) return FAILURE;
+  slot_lock(elem);
+  if ( elem->storage != STORAGE_RING || elem->ring.consumer != NULL ){
+    //the consumer side belongs to a user space mapping
+    spin_unlock( &(elem->queue_lock) );
+    mutex_unlock( &(elem->r_mutex) );
+    return FAILURE;
+  }
+  ret = wait_for_message(elem, session_timeout(s, NO));
+  if ( ret != SUCCESS ){
+    mutex_unlock( &(elem->r_mutex) );
+    return ret;
+  }
+  head = READ_ONCE(elem->ring.ctrl->head);
+  tail = smp_load_acquire(&elem->ring.ctrl->tail);
+  spin_unlock( &(elem->queue_lock) );
+
+  for ( pos = head ; pos != tail ; pos += LMS_RING_RECORD_SIZE(msg_len) ){
+    msg_len = READ_ONCE(*(u32*)(elem->ring.data + (pos & (elem->ring.size - 1))));
+    if ( !ring_record_valid(elem, pos, tail, msg_len) ){
+      pr_debug_ratelimited("%s: malformed ring record of %u bytes in the slot with minor %d, %u bytes dropped\n", MODNAME, msg_len, elem->minor, tail - pos);
+      WRITE_ONCE(elem->ring.ctrl->broken, READ_ONCE(elem->ring.ctrl->broken) + 1);
+      pos = tail;
+      break;
+    }
+    //the read has to be all or nothing, a record that does not fit stays in the ring
+    room = batch_room(b, to);
+    if ( msg_len > room ) break;
+    if ( batch_head(b, to, msg_len) != SUCCESS || ring_copy_to_iter(&elem->ring, pos + LMS_RING_HDR_SIZE, to, msg_len) != SUCCESS ) break;
+    if ( batch_next(b, to, room, msg_len) != SUCCESS ) break;
+    b->count++;
+    done += msg_len;
+    stat_out(elem, msg_len, 0);
+  }
+
+  //release the records
+  if ( pos != head ){
+    slot_lock(elem);
+    smp_store_release(&elem->ring.ctrl->head, pos);
+    notify_writers(elem);
+    pass_on_readers(elem);
+    spin_unlock( &(elem->queue_lock) );
+  }
+  mutex_unlock( &(elem->r_mutex) );
+  return done > 0 ? done : FAILURE;
+}
+
+
+//plain write and read of the storages that work on an iov_iter
+ssize_t single_write(session* s, const char* buff, size_t len){
+  struct iovec iov;
+  struct iov_iter iter;
+  if ( import_user_range(WRITE, (char __user *) buff, len, &iov, &iter) != 0 ) return FAILURE;
+  return storage_write_iter(s, &iter);
+}
+
+
+ssize_t single_read(session* s, char* buff, size_t len){
+  struct iovec iov;
+  struct iov_iter iter;
+  batch b = { .max_msgs = 1, .lens = NULL, .count = 0 };
+  if ( import_user_range(READ, buff, len, &iov, &iter) != 0 ) return FAILURE;
+  return storage_read_iter(s, &iter, &b);
+}
+
+
+/*
+CHANGE_SPILL: the log of a list slot is a header holding the offset of the first record not read
+back and the records appended after it. file I/O sleeps, so the log is only touched under
+spill.mutex and queue_lock is taken just to link a message read back. a message goes to the log
+when it does not fit the budget or when older ones are still on disk, every read gives the space
+it freed to the head of the log first, so the messages come out in write order
+*/
+static void spill_job_run(struct work_struct* work){
+  spill_job* job = container_of(work, spill_job, work);
+  job->call(job);
+}
+
+
+//the files are opened, grown and cut by a kworker, with the credentials, the mount namespace and
+//the file size limit of the kernel and not with those of whichever task writes or reads the slot
+static long spill_call(spill_job* job){
+  INIT_WORK_ONSTACK(&job->work, spill_job_run);
+  queue_work(system_unbound_wq, &job->work);
+  flush_work(&job->work);
+  destroy_work_on_stack(&job->work);
+  return job->ret;
+}
+
+
+static void spill_open_call(spill_job* job){
+  job->f = filp_open(job->path, job->flags | O_LARGEFILE, 0600);
+}
+
+
+static void spill_io_call(spill_job* job){
+  ssize_t ret;
+  job->ret = SUCCESS;
+  while ( job->len > 0 ){
+    ret = job->write ? kernel_write(job->f, job->buf, job->len, job->pos) : kernel_read(job->f, job->buf, job->len, job->pos);
+    if ( ret <= 0 ){
+      job->ret = FAILURE;
+      return;
+    }
+    job->buf = (char*) job->buf + ret;
+    job->len -= ret;
+  }
+}
+
+
+static void spill_truncate_call(spill_job* job){
+  job->ret = vfs_truncate(&job->f->f_path, job->size);
+}
+
+
+static struct file* spill_file(slot_elem* elem, const char* ext, int flags){
+  spill_job job = { .call = spill_open_call, .flags = flags };
+  char* path = kasprintf(GFP_KERNEL, "%s/mailslot%d.%s", spill_dir, elem->minor, ext);
+  if ( path == NULL ) return ERR_PTR(-ENOMEM);
+  job.path = path;
+  spill_call(&job);
+  kfree(path);
+  return job.f;
+}
+
+
+//read or write len bytes at *pos, moving it past them
+static int spill_io(struct file* f, void* buf, size_t len, loff_t* pos, int write){
+  spill_job job = { .call = spill_io_call, .f = f, .buf = buf, .len = len, .pos = pos, .write = write };
+  return spill_call(&job);
+}
+
+
+static int spill_truncate(struct file* f, loff_t size){
+  spill_job job = { .call = spill_truncate_call, .f = f, .size = size };
+  return spill_call(&job);
+}
+
+
+//the payload of a message, page by page for the large ones
+static int msg_spill_io(message* msg, struct file* f, loff_t* pos, int write){
+  size_t done, chunk;
+  u32 i;
+  if ( msg->size_class != LARGE_CLASS ) return spill_io(f, msg->payload, msg->size, pos, write);
+  for ( i = 0, done = 0 ; done < msg->size ; i++, done += chunk ){
+    chunk = min_t(size_t, msg->size - done, PAGE_SIZE);
+    if ( spill_io(f, page_address(msg->pages[i]), chunk, pos, write) != SUCCESS ) return FAILURE;
+  }
+  return SUCCESS;
+}
+
+
+//next record header at *pos, FAILURE past the end of the file or when it cannot be a record
+static int spill_record(struct file* f, struct lms_spill_record* rec, loff_t* pos, loff_t end){
+  if ( *pos + (loff_t) sizeof(*rec) > end || spill_io(f, rec, sizeof(*rec), pos, NO) != SUCCESS ) return FAILURE;
+  if ( rec->len == 0 || rec->len > MSG_SIZE_LIMIT || rec->prio >= LMS_PRIO_LEVELS || *pos + rec->len > end ) return FAILURE;
+  return SUCCESS;
+}
+
+
+//a message of a log or of a saved memory, NULL when it cannot be read
+static message* spill_read_msg(slot_elem* elem, struct file* f, struct lms_spill_record* rec, loff_t* pos){
+  message* msg = alloc_message(elem, rec->len);
+  if ( msg == NULL ) return NULL;
+  msg->size = rec->len;
+  //the clock starts over at boot, a stamp of the previous one would be in the future
+  msg->stamp = min_t(u64, rec->stamp, ktime_get_ns());
+  if ( msg_spill_io(msg, f, pos, NO) != SUCCESS ){
+    free_message(elem, msg);
+    return NULL;
+  }
+  return msg;
+}
+
+
+static void spill_sync_head(spill* sp){
+  struct lms_spill_hdr hdr = { .magic = LMS_SPILL_MAGIC, .version = LMS_SPILL_VERSION, .head = sp->head };
+  loff_t pos = 0;
+  if ( spill_io(sp->log, &hdr, sizeof(hdr), &pos, YES) != SUCCESS ) pr_debug_ratelimited("%s: cannot update the spill log header\n", MODNAME);
+}
+
+
+//append a message at the tail of the log, NOT_ENOUGH_SPACE_ERROR when the log reached spill_max
+static int spill_append(slot_elem* elem, message* msg, int prio){
+  spill* sp = &(elem->spill);
+  struct lms_spill_record rec = { .len = msg->size, .prio = prio, .stamp = msg->stamp };
+  loff_t pos = sp->tail;
+  if ( sp->tail + (loff_t) sizeof(rec) + msg->size > spill_max ) return NOT_ENOUGH_SPACE_ERROR;
+  //a record written in part is past tail, the next append overwrites it
+  if ( spill_io(sp->log, &rec, sizeof(rec), &pos, YES) != SUCCESS || msg_spill_io(msg, sp->log, &pos, YES) != SUCCESS ) return MSWRITE_ERROR;
+  sp->tail = pos;
+  WRITE_ONCE(sp->msgs, sp->msgs + 1);
+  this_cpu_inc(elem->stats->spilled);
+  return SUCCESS;
+}
+
+
+//bring the records at the head of the log back in memory while they fit the budget, under spill.mutex
+static void spill_pull(slot_elem* elem){
+
+  spill* sp = &(elem->spill);
+  struct lms_spill_record rec;
+  message* msg;
+  loff_t pos;
+  int moved = 0;
+
+  while ( sp->msgs > 0 ){
+    pos = sp->head;
+    if ( spill_record(sp->log, &rec, &pos, sp->tail) != SUCCESS ){
+      pr_debug_ratelimited("%s: the spill log of the mailslot with minor %d cannot be read, %u messages lost\n", MODNAME, elem->minor, sp->msgs);
+      sp->head = sp->tail;
+      WRITE_ONCE(sp->msgs, 0);
+      moved++;
+      break;
+    }
+    if ( !space_reserve(elem, rec.len) ) break;
+    msg = spill_read_msg(elem, sp->log, &rec, &pos);
+    if ( msg == NULL ){
+      //the next read tries again
+      space_cancel(elem, rec.len);
+      break;
+    }
+    sp->head = pos;
+    WRITE_ONCE(sp->msgs, sp->msgs - 1);
+    slot_lock(elem);
+    push_message(elem, msg, rec.prio);
+    stat_depth(elem);
+    notify_readers(elem);
+    slot_unlock(elem);
+    moved++;
+  }
+  if ( moved == 0 ) return;
+  if ( sp->msgs == 0 ){
+    //drained, the log starts over
+    sp->head = sizeof(struct lms_spill_hdr);
+    sp->tail = sp->head;
+    spill_truncate(sp->log, sp->tail);
+  }
+  spill_sync_head(sp);
+}
+
+
+//the messages of a write on a spilling slot, consumed in order up to the first failure: in memory
+//while nothing is on disk and they fit, in the log otherwise
+static int spill_write(slot_elem* elem, message** chain, int prio, ssize_t* done){
+
+  spill* sp = &(elem->spill);
+  message* msg;
+  int ret = SUCCESS;
+
+  mutex_lock( &(sp->mutex) );
+  //stopped meanwhile, the chain goes through the list path
+  if ( sp->log == NULL ){
+    mutex_unlock( &(sp->mutex) );
+    return SUCCESS;
+  }
+  while ( *chain != NULL ){
+    msg = *chain;
+    if ( sp->msgs == 0 && space_reserve(elem, msg->size) ){
+      *chain = msg->next;
+      *done += msg->size;
+      slot_lock(elem);
+      stat_in(elem, msg->size);
+      push_message(elem, msg, prio);
+      stat_depth(elem);
+      notify_readers(elem);
+      slot_unlock(elem);
+      continue;
+    }
+    ret = spill_append(elem, msg, prio);
+    if ( ret != SUCCESS ){
+      stat_reject(elem, msg->size, ret);
+      break;
+    }
+    *chain = msg->next;
+    *done += msg->size;
+    stat_in(elem, msg->size);
+    free_message(elem, msg);
+  }
+  //the readers may have made room meanwhile
+  spill_pull(elem);
+  mutex_unlock( &(sp->mutex) );
+  return ret;
+}
+
+
+//after a read, the space it freed goes to the log first
+void spill_refill(slot_elem* elem){
+  if ( READ_ONCE(elem->spill.msgs) == 0 ) return;
+  mutex_lock( &(elem->spill.mutex) );
+  if ( elem->spill.log != NULL ) spill_pull(elem);
+  mutex_unlock( &(elem->spill.mutex) );
+}
+
+
+//open the log of a slot and walk its records, a torn one at the end is cut. NULL when there is no
+//log, when create is NO and the log was stopped, or when the file is not a log
+static struct file* spill_open(slot_elem* elem, int create){
+
+  spill* sp = &(elem->spill);
+  struct lms_spill_hdr hdr;
+  struct lms_spill_record rec;
+  struct file* f = spill_file(elem, "log", O_RDWR | (create ? O_CREAT : 0));
+  loff_t end, pos = 0;
+
+  if ( IS_ERR(f) ) return NULL;
+  end = vfs_llseek(f, 0, SEEK_END);
+  if ( end < (loff_t) sizeof(hdr) && create ){
+    //a new log, or one stopped by CHANGE_SPILL
+    hdr = (struct lms_spill_hdr){ .magic = LMS_SPILL_MAGIC, .version = LMS_SPILL_VERSION, .head = sizeof(hdr) };
+    end = sizeof(hdr);
+    if ( spill_truncate(f, 0) != 0 || spill_io(f, &hdr, sizeof(hdr), &pos, YES) != SUCCESS ) end = -1;
+  }
+  else if ( end < (loff_t) sizeof(hdr) || spill_io(f, &hdr, sizeof(hdr), &pos, NO) != SUCCESS || hdr.magic != LMS_SPILL_MAGIC ||
+            hdr.version != LMS_SPILL_VERSION || hdr.head < sizeof(hdr) || hdr.head > end ) end = -1;
+  if ( end < 0 ){
+    filp_close(f, NULL);
+    return NULL;
+  }
+  sp->head = hdr.head;
+  sp->tail = hdr.head;
+  sp->msgs = 0;
+  pos = sp->tail;
+  while ( spill_record(f, &rec, &pos, end) == SUCCESS ){
+    pos += rec.len;
+    sp->tail = pos;
+    sp->msgs++;
+  }
+  if ( sp->tail < end ){
+    pr_debug("%s: torn record cut at offset %lld of the spill log of the mailslot with minor %d\n", MODNAME, (long long) sp->tail, elem->minor);
+    spill_truncate(f, sp->tail);
+  }
+  return f;
+}
+
+
+//the messages in memory at the last unload come back first, in their order. they fit the budget
+//of that load, so they are linked even when they do not fit the current one
+static void spill_restore(slot_elem* elem){
+
+  struct lms_spill_record rec;
+  struct file* f = spill_file(elem, "mem", O_RDWR);
+  message* msg;
+  loff_t end, pos = 0;
+
+  if ( IS_ERR(f) ) return;
+  end = vfs_llseek(f, 0, SEEK_END);
+  while ( spill_record(f, &rec, &pos, end) == SUCCESS && (msg = spill_read_msg(elem, f, &rec, &pos)) != NULL ){
+    atomic_sub(msg->size, &elem->free_mem);
+    push_message(elem, msg, rec.prio);
+  }
+  if ( pos < end ) pr_debug("%s: saved messages of the mailslot with minor %d lost from offset %lld\n", MODNAME, elem->minor, (long long) pos);
+  //consumed, an empty file is ignored by the next load
+  spill_truncate(f, 0);
+  filp_close(f, NULL);
+}
+
+
+//a new slot picks up the files a previous load left in spill_dir
+static void spill_recover(slot_elem* elem){
+  struct file* f;
+  if ( spill_dir[0] == '\0' ) return;
+  f = spill_open(elem, NO);
+  if ( f == NULL ) return;
+  elem->spill.log = f;
+  spill_restore(elem);
+  stat_depth(elem);
+  spill_pull(elem);
+  pr_debug("%s: mailslot with minor %d recovered, %u messages on disk\n", MODNAME, elem->minor, elem->spill.msgs);
+}
+
+
+//the slot goes away, the messages in memory are saved for the next load and the log keeps its head
+static void spill_close(slot_elem* elem){
+
+  spill* sp = &(elem->spill);
+  struct lms_spill_record rec;
+  struct file* f = NULL;
+  message* msg;
+  loff_t pos = 0;
+  int lost = 0;
+
+  if ( sp->log == NULL ) return;
+  if ( elem->prio_map != 0 ){
+    f = spill_file(elem, "mem", O_WRONLY | O_CREAT | O_TRUNC);
+    if ( IS_ERR(f) ) f = NULL;
+  }
+  while ( f != NULL && elem->prio_map != 0 ){
+    rec.prio = __fls(elem->prio_map);
+    msg = pop_message(elem);
+    rec.len = msg->size;
+    rec.stamp = msg->stamp;
+    if ( lost == 0 && (spill_io(f, &rec, sizeof(rec), &pos, YES) != SUCCESS || msg_spill_io(msg, f, &pos, YES) != SUCCESS) ) lost = 1;
+    free_message(elem, msg);
+  }
+  if ( f != NULL ){
+    vfs_fsync(f, 0);
+    filp_close(f, NULL);
+  }
+  if ( elem->prio_map != 0 || lost ) pr_debug("%s: cannot save the messages of the mailslot with minor %d\n", MODNAME, elem->minor);
+  spill_sync_head(sp);
+  vfs_fsync(sp->log, 0);
+  filp_close(sp->log, NULL);
+  sp->log = NULL;
+}
+
+
+//CHANGE_SPILL: an empty list slot starts spilling, one with nothing on disk stops and truncates
+//its log, so that the next load does not pick it up
+int change_spill(slot_elem* elem, unsigned long on){
+
+  spill* sp = &(elem->spill);
+  struct file* f;
+  int status = SUCCESS;
+
+  if ( on > 1 || spill_dir[0] == '\0' ){
+    pr_debug_ratelimited("%s: Error, spilling needs the spill_dir parameter and a value of 0 or 1\n", MODNAME);
+    return FAILURE;
+  }
+  mutex_lock( &(sp->mutex) );
+  if ( on && sp->log == NULL ){
+    slot_lock(elem);
+    if ( elem->storage != STORAGE_LIST || !slot_empty(elem) ) status = FAILURE;
+    slot_unlock(elem);
+    f = ( status == SUCCESS ) ? spill_open(elem, YES) : NULL;
+    if ( f == NULL ) status = FAILURE;
+    else {
+      //a storage switch checks the log under the same lock
+      slot_lock(elem);
+      if ( elem->storage == STORAGE_LIST ) WRITE_ONCE(sp->log, f);
+      slot_unlock(elem);
+      if ( sp->log == NULL ){
+        filp_close(f, NULL);
+        status = FAILURE;
+      }
+      else spill_pull(elem);
+    }
+    if ( status != SUCCESS ) pr_debug_ratelimited("%s: Error, only an empty STORAGE_LIST mailslot can start spilling\n", MODNAME);
+  }
+  else if ( !on && sp->log != NULL ){
+    if ( sp->msgs != 0 ){
+      pr_debug_ratelimited("%s: Error, the mailslot still has %u messages on disk\n", MODNAME, sp->msgs);
+      status = FAILURE;
+    }
+    else {
+      f = sp->log;
+      WRITE_ONCE(sp->log, NULL);
+      spill_truncate(f, 0);
+      filp_close(f, NULL);
+    }
+  }
+  mutex_unlock( &(sp->mutex) );
+  return status;
+}
+
+
+//every iovec segment is one message, all of them are allocated and filled before taking the lock
+//broadcast slots share this path, only the enqueue differs
+static ssize_t list_write_iter(session* s, struct iov_iter* from, long timeout){
+
+  slot_elem* elem = s->slot;
+  const size_t max_size = READ_ONCE(s->curr_size);
+  const int prio = READ_ONCE(s->prio);
+  int ret = SUCCESS;
+  size_t len;
+  ssize_t done = 0;
+  message *msg, *chain = NULL, **last = &chain;
+
+  while ( iov_iter_count(from) > 0 ){
+    len = iov_iter_single_seg_count(from);
+    if ( len == 0 || len > max_size ){
+      stat_reject(elem, len, FAILURE);
+      ret = FAILURE;
+      break;
+    }
+    msg = alloc_message(elem, len);
+    if ( msg == NULL ){
+      ret = MSPUSH_ERROR;
+      break;
+    }
+    msg->size = len;
+    msg->stamp = ktime_get_ns();
+    *last = msg;
+    last = &msg->next;
+    if ( msg_copy_from_iter(msg, len, from) != SUCCESS ){
+      ret = FAILURE;
+      break;
+    }
+  }
+
+  if ( ret == SUCCESS && READ_ONCE(elem->spill.log) != NULL ) ret = spill_write(elem, &chain, prio, &done);
+  if ( ret == SUCCESS && chain != NULL ){
+    slot_lock(elem);
+    while ( chain != NULL ){
+      ret = make_room(elem, chain->size, timeout);
+      if ( ret == MSG_DROPPED ){
+        //the message counts as written, the others still have a chance
+        msg = chain;
+        chain = chain->next;
+        done += msg->size;
+        free_message(elem, msg);
+        ret = SUCCESS;
+        slot_lock(elem);
+        continue;
+      }
+      if ( ret != SUCCESS ) break;
+      if ( elem->storage != STORAGE_LIST && elem->storage != STORAGE_BROADCAST ){
+        slot_unlock(elem);
+        ret = FAILURE;
+        break;
+      }
+      msg = chain;
+      chain = chain->next;
+      done += msg->size;
+      stat_in(elem, msg->size);
+      if ( elem->storage == STORAGE_BROADCAST ){
+        bcast_push(elem, msg);
+        continue;
+      }
+      push_message(elem, msg, prio);
+      notify_readers(elem);
+    }
+    if ( ret == SUCCESS ){
+      stat_depth(elem);
+      pass_on_writers(elem);
+      slot_unlock(elem);
+    }
+  }
+
+  //whatever could not be pushed
+  while ( chain != NULL ){
+    msg = chain;
+    chain = chain->next;
+    free_message(elem, msg);
+  }
+  return done > 0 ? done : ret;
+}
+
+
+//detach every message that fits the batch layout under a single lock acquisition, then copy them out.
+//their space goes back once they are delivered, the ones a failed copy did not deliver are linked back
+static ssize_t list_read_iter(session* s, struct iov_iter* to, batch* b){
+
+  slot_elem* elem = s->slot;
+  int ret;
+  size_t room;
+  ssize_t done = 0;
+  struct iov_iter probe = *to;
+  message *msg, *chain = NULL, **last = &chain;
+
+  slot_lock(elem);
+  ret = wait_for_message(elem, session_timeout(s, NO));
+  if ( ret != SUCCESS ) return ret;
+  if ( elem->storage != STORAGE_LIST ){
+    //the slot moved to another storage while we were waiting
+    slot_unlock(elem);
+    return storage_read_iter(s, to, b);
+  }
+  while ( !slot_empty(elem) && b->count < b->max_msgs ){
+    room = batch_room(b, &probe);
+    if ( slot_head(elem)->size > room ) break;
+    msg = unlink_level(elem, __fls(elem->prio_map));
+    msg->next = NULL;
+    *last = msg;
+    last = &msg->next;
+    if ( b->max_msgs > 1 ) iov_iter_advance(&probe, ( b->lens != NULL ) ? msg->size : b->records ? LMS_RING_RECORD_SIZE(msg->size) : room);
+    b->count++;
+  }
+  if ( chain == NULL ){
+    //the head message does not fit, the read has to be all or nothing
+    notify_readers(elem);
+    slot_unlock(elem);
+    return FAILURE;
+  }
+  pass_on_readers(elem);
+  slot_unlock(elem);
+
+  //the messages are not reachable anymore, copy them out of the lock
+  b->count = 0;
+  while ( chain != NULL ){
+    msg = chain;
+    room = batch_room(b, to);
+    if ( batch_head(b, to, msg->size) != SUCCESS || msg_copy_to_iter(msg, to) != SUCCESS || batch_next(b, to, room, msg->size) != SUCCESS ) break;
+    chain = chain->next;
+    b->count++;
+    done += msg->size;
+    stat_out(elem, msg->size, msg->stamp);
+    space_release(elem, msg->size);
+    free_message(elem, msg);
+  }
+  if ( chain != NULL ){
+    //a bad user buffer: the message that failed and the ones after it were not delivered
+    slot_lock(elem);
+    relink_messages(elem, chain);
+    notify_readers(elem);
+    slot_unlock(elem);
+  }
+  if ( done > 0 ) notify_writers(elem);
+  return done > 0 ? done : FAILURE;
+}
+
+
+//lock free storage: writers and readers meet only on the queue atomics, the queue_lock and
+//the wait queues are touched by the tasks that have to sleep and by whoever has to wake them up
+static ssize_t lf_write_iter(session* s, struct iov_iter* from, long timeout){
+
+  slot_elem* elem = s->slot;
+  const size_t max_size = READ_ONCE(s->curr_size);
+  int ret = SUCCESS;
+  size_t len;
+  ssize_t done = 0;
+  message* msg;
+
+  while ( iov_iter_count(from) > 0 ){
+    len = iov_iter_single_seg_count(from);
+    if ( len == 0 || len > max_size ){
+      stat_reject(elem, len, FAILURE);
+      ret = FAILURE;
+      break;
+    }
+    msg = alloc_message(elem, len);
+    if ( msg == NULL ){
+      ret = MSPUSH_ERROR;
+      break;
+    }
+    msg->size = len;
+    if ( msg_copy_from_iter(msg, len, from) != SUCCESS ){
+      free_message(elem, msg);
+      ret = FAILURE;
+      break;
+    }
+    msg->stamp = ktime_get_ns();
+    ret = lf_push(elem, msg);
+    while ( ret == NOT_ENOUGH_SPACE_ERROR ){
+      //slow path: sleep until a reader gives the space back, then race for it again
+      slot_lock(elem);
+      ret = make_room(elem, len, timeout);
+      if ( ret != SUCCESS ) break;
+      //the slot may have switched storage while this writer slept
+      if ( elem->storage != STORAGE_LOCKFREE ) slot_unclaim(elem, len);
+      slot_unlock(elem);
+      ret = ( READ_ONCE(elem->storage) == STORAGE_LOCKFREE ) ? lf_push(elem, msg) : FAILURE;
+      if ( ret == SUCCESS ) pass_on_writers(elem);
+    }
+    if ( ret == MSG_DROPPED ){
+      free_message(elem, msg);
+      done += len;
+      continue;
+    }
+    if ( ret != SUCCESS ){
+      free_message(elem, msg);
+      break;
+    }
+    done += len;
+    stat_in(elem, len);
+    stat_depth(elem);
+    notify_readers(elem);
+  }
+  return done > 0 ? done : ret;
+}
+
+
+//the call sleeps only for the first message, the others are taken while they are there and fit
+static ssize_t lf_read_iter(session* s, struct iov_iter* to, batch* b){
+
+  slot_elem* elem = s->slot;
+  int ret = SUCCESS;
+  size_t room, len;
+  ssize_t done = 0;
+  message* msg;
+
+  while ( (room = batch_room(b, to)) > 0 ){
+    ret = lf_pop(elem, room, &msg);
+    if ( ret == FAILURE && b->count == 0 ){
+      //slow path: wait for a writer, then race for the message with the other readers
+      slot_lock(elem);
+      ret = wait_for_message(elem, session_timeout(s, NO));
+      if ( ret != SUCCESS ) return ret;
+      slot_unlock(elem);
+      if ( READ_ONCE(elem->storage) != STORAGE_LOCKFREE ) return FAILURE;
+      continue;
+    }
+    if ( ret != SUCCESS ) break;
+    notify_writers(elem);
+    if ( msg_expired(elem, msg, ktime_get_ns()) ){
+      this_cpu_inc(elem->stats->expired);
+      free_message(elem, msg);
+      continue;
+    }
+    len = msg->size;
+    ret = ( batch_head(b, to, len) != SUCCESS || msg_copy_to_iter(msg, to) != SUCCESS ) ? FAILURE : batch_next(b, to, room, len);
+    if ( ret == SUCCESS ) stat_out(elem, len, msg->stamp);
+    free_message(elem, msg);
+    if ( ret != SUCCESS ) break;
+    b->count++;
+    done += len;
+  }
+  if ( ret == MSREAD_ERROR ){
+    //the head message does not fit, the exclusive wakeup this reader may have taken goes on
+    slot_lock(elem);
+    pass_on_readers(elem);
+    slot_unlock(elem);
+  }
+  return done > 0 ? done : FAILURE;
+}
+
+
+//wait for a message after the cursor of a subscriber, unlike the other storages every reader is woken up
+//called with queue_lock held, on SUCCESS it returns with the lock held, otherwise the lock is released
+static int bcast_wait(session* s, long* timeout){
+
+  slot_elem* elem = s->slot;
+  long ret;
+  u64 start;
+
+  if ( *timeout == 0 ){
+    stat_reject(elem, 0, FAILURE);
+    slot_unlock(elem);
+    this_cpu_inc(elem->stats->eagain);
+    return FAILURE;
+  }
+  slot_unlock(elem);
+  this_cpu_inc(elem->stats->blocked_readers);
+  if ( trace_lms_block_enabled() ) trace_lms_block(elem->minor, 0, slot_depth(elem), NO);
+  start = ktime_get_ns();
+  ret = wait_event_interruptible_timeout(elem->readers, bcast_ready(s), *timeout);
+  stat_hist(elem->stats->sleep, ktime_get_ns() - start);
+  if ( trace_lms_wake_enabled() ) trace_lms_wake(elem->minor, 0, slot_depth(elem), NO);
+  slot_lock(elem);
+  if ( ret <= 0 ){
+    slot_unlock(elem);
+    if ( ret == 0 ){
+      stat_reject(elem, 0, TIMEOUT_ERROR);
+      return TIMEOUT_ERROR;
+    }
+    pr_debug_ratelimited("%s: The process [read] %d has been awaken by a signal\n", MODNAME , current->pid);
+    return FAILURE;
+  }
+  *timeout = ret;
+  return SUCCESS;
+}
+
+
+//broadcast storage: the messages after the cursor of the session, the call sleeps only for the first one.
+//a message is pinned while it is copied out of the lock, a writer may push it out of the ring meanwhile
+static ssize_t bcast_read_iter(session* s, struct iov_iter* to, batch* b){
+
+  slot_elem* elem = s->slot;
+  bcast* bc = &(elem->bcast);
+  long timeout = session_timeout(s, NO);
+  int ret;
+  size_t room, len;
+  ssize_t done = 0;
+  message* msg;
+
+  slot_lock(elem);
+  while ( b->count < b->max_msgs ){
+    if ( elem->storage != STORAGE_BROADCAST ){
+      //the slot moved to another storage while we were waiting
+      slot_unlock(elem);
+      return done > 0 ? done : storage_read_iter(s, to, b);
+    }
+    bcast_join(s);
+    expire_messages(elem);
+    if ( s->cursor < bc->head ){
+      this_cpu_add(elem->stats->lagged, bc->head - s->cursor);
+      s->cursor = bc->head;
+    }
+    if ( s->cursor == bc->tail ){
+      if ( b->count > 0 ) break;
+      ret = bcast_wait(s, &timeout);
+      if ( ret != SUCCESS ) return ret;
+      continue;
+    }
+    msg = bc->msgs[s->cursor & (BCAST_CELLS - 1)];
+    room = batch_room(b, to);
+    if ( msg->size > room ){
+      //the read has to be all or nothing, the message stays for the next call
+      if ( b->count == 0 ) stat_reject(elem, msg->size, FAILURE);
+      break;
+    }
+    s->cursor++;
+    msg->pending--;
+    msg->refs++;
+    bcast_trim(elem);
+    slot_unlock(elem);
+
+    len = msg->size;
+    ret = ( batch_head(b, to, len) != SUCCESS || msg_copy_to_iter(msg, to) != SUCCESS ) ? FAILURE : batch_next(b, to, room, len);
+    if ( ret == SUCCESS ){
+      stat_out(elem, len, msg->stamp);
+      b->count++;
+      done += len;
+    }
+    slot_lock(elem);
+    bcast_put(elem, msg);
+    if ( ret != SUCCESS ) break;
+  }
+  slot_unlock(elem);
+  return done > 0 ? done : FAILURE;
+}
+
+
+//LMS_READ_PEEK: copy the next message and leave it queued. the message may be taken and freed
+//as soon as the lock is released, so the payload goes through a bounce buffer filled under it.
+//a lock free slot has no stable head to copy from
+static ssize_t peek_read_iter(session* s, struct iov_iter* to, batch* b){
+
+  slot_elem* elem = s->slot;
+  const size_t room = batch_room(b, to);
+  const size_t cap = min_t(size_t, room, max_msg_size);
+  char* bounce;
+  message* msg;
+  u32 len = 0, off, first;
+  int ret;
+
+  if ( cap == 0 ) return FAILURE;
+  bounce = kvmalloc(cap, GFP_KERNEL);
+  if ( bounce == NULL ) return FAILURE;
+  slot_lock(elem);
+  ret = wait_for_message(elem, session_timeout(s, NO));
+  if ( ret != SUCCESS ){
+    kvfree(bounce);
+    return ret;
+  }
+  ret = FAILURE;
+  if ( elem->storage == STORAGE_LIST ){
+    msg = slot_head(elem);
+    len = msg->size;
+    if ( len <= cap ){
+      msg_copy_out(msg, bounce);
+      ret = SUCCESS;
+    }
+  }
+  else if ( elem->storage == STORAGE_RING && elem->ring.consumer == NULL ){
+    //kernel readers release records under the lock, the head record stays put meanwhile
+    off = READ_ONCE(elem->ring.ctrl->head);
+    len = READ_ONCE(*(u32*)(elem->ring.data + (off & (elem->ring.size - 1))));
+    if ( len <= cap && ring_record_valid(elem, off, smp_load_acquire(&elem->ring.ctrl->tail), len) ){
+      off = (off + LMS_RING_HDR_SIZE) & (elem->ring.size - 1);
+      first = min_t(u32, len, elem->ring.size - off);
+      memcpy(bounce, elem->ring.data + off, first);
+      memcpy(bounce + first, elem->ring.data, len - first);
+      ret = SUCCESS;
+    }
+  }
+  if ( ret != SUCCESS ) stat_reject(elem, len, FAILURE);
+  //a wakeup taken by this read was not used up
+  pass_on_readers(elem);
+  slot_unlock(elem);
+
+  if ( ret == SUCCESS && (batch_head(b, to, len) != SUCCESS || copy_to_iter(bounce, len, to) != len || batch_next(b, to, room, len) != SUCCESS) ) ret = FAILURE;
+  kvfree(bounce);
+  if ( ret != SUCCESS ) return FAILURE;
+  b->count++;
+  return len;
+}
+
+
+//route an iov_iter operation to the storage of the slot
+static ssize_t storage_write(session* s, struct iov_iter* from, long timeout){
+  switch ( READ_ONCE(s->slot->storage) ){
+    case STORAGE_RING:
+      return ring_write_iter(s, from, timeout);
+    case STORAGE_LOCKFREE:
+      return lf_write_iter(s, from, timeout);
+    default:
+      return list_write_iter(s, from, timeout);
+  }
+}
+
+
+//CHANGE_COALESCING: the records of a session are packed in its batch buffer and written as one
+//message, the index is appended at flush time. all of it runs under co_mutex
+//whether a record of rec bytes and its index entry fit the batch, in size_t so that a nearly full
+//batch cannot wrap around
+static int coalesce_fits(session* s, size_t rec){
+  return (size_t) s->co_len + rec + (size_t) (s->co_count + 1) * sizeof(u32) <= s->co_size;
+}
+
+
+static int flush_batch(session* s, long timeout){
+
+  struct lms_coalesced* hdr = (struct lms_coalesced*) s->coalesce;
+  u32* index = (u32*) (s->coalesce + s->co_len);
+  struct kvec kv;
+  struct iov_iter iter;
+  ssize_t ret;
+  u32 i, off;
+
+  if ( s->co_count == 0 ) return SUCCESS;
+  hdr->magic = LMS_COALESCED_MAGIC;
+  hdr->count = s->co_count;
+  hdr->index = s->co_len;
+  hdr->reserved = 0;
+  for ( i = 0, off = sizeof(*hdr) ; i < s->co_count ; i++ ){
+    index[i] = off;
+    off += LMS_RING_RECORD_SIZE(*(u32*) (s->coalesce + off));
+  }
+  kv.iov_base = s->coalesce;
+  kv.iov_len = s->co_len + s->co_count * sizeof(u32);
+  iov_iter_kvec(&iter, WRITE, &kv, 1, kv.iov_len);
+  ret = storage_write(s, &iter, timeout);
+  //the records stay in the buffer, the next flush tries again
+  if ( ret < 0 ) return ret;
+  this_cpu_add(s->slot->stats->coalesced, s->co_count);
+  s->co_len = sizeof(*hdr);
+  s->co_count = 0;
+  return SUCCESS;
+}
+
+
+static ssize_t coalesce_write_iter(session* s, struct iov_iter* from){
+
+  const long timeout = session_timeout(s, YES);
+  int ret = SUCCESS;
+  size_t len, rec;
+  ssize_t done = 0;
+
+  if ( mutex_lock_interruptible( &(s->co_mutex) ) != 0 ) return FAILURE;
+  //coalescing was turned off meanwhile
+  if ( s->coalesce == NULL ){
+    mutex_unlock( &(s->co_mutex) );
+    return storage_write(s, from, timeout);
+  }
+  while ( iov_iter_count(from) > 0 ){
+    len = iov_iter_single_seg_count(from);
+    rec = LMS_RING_RECORD_SIZE(len);
+    if ( len == 0 || LMS_COALESCED_SIZE(1, len) > s->co_size ){
+      stat_reject(s->slot, len, FAILURE);
+      ret = FAILURE;
+      break;
+    }
+    if ( !coalesce_fits(s, rec) ){
+      ret = flush_batch(s, timeout);
+      if ( ret != SUCCESS ) break;
+    }
+    if ( copy_from_iter(s->coalesce + s->co_len + LMS_RING_HDR_SIZE, len, from) != len ){
+      ret = FAILURE;
+      break;
+    }
+    //the padding reaches user space, it must not carry stale bytes
+    memset(s->coalesce + s->co_len + LMS_RING_HDR_SIZE + len, 0, rec - LMS_RING_HDR_SIZE - len);
+    *(u32*) (s->coalesce + s->co_len) = len;
+    s->co_len += rec;
+    s->co_count++;
+    done += len;
+    if ( s->co_count == 1 ) schedule_delayed_work(&s->co_work, msecs_to_jiffies(s->linger));
+  }
+  mutex_unlock( &(s->co_mutex) );
+  return done > 0 ? done : ret;
+}
+
+
+//linger expired: write the batch if the slot has space now, a worker never sleeps for it
+static void coalesce_linger(struct work_struct* work){
+
+  session* s = container_of(to_delayed_work(work), session, co_work);
+
+  mutex_lock( &(s->co_mutex) );
+  if ( s->coalesce != NULL && flush_batch(s, 0) != SUCCESS && s->co_count > 0 )
+    schedule_delayed_work(&s->co_work, msecs_to_jiffies(s->linger));
+  mutex_unlock( &(s->co_mutex) );
+}
+
+
+void coalesce_init(session* s){
+  s->coalesce = NULL;
+  s->co_size = 0;
+  s->co_len = 0;
+  s->co_count = 0;
+  s->linger = 0;
+  mutex_init( &(s->co_mutex) );
+  INIT_DELAYED_WORK(&s->co_work, coalesce_linger);
+}
+
+
+//FLUSH_MESSAGES, it waits for space like a write of the session
+int coalesce_flush(session* s){
+
+  int ret = SUCCESS;
+
+  if ( mutex_lock_interruptible( &(s->co_mutex) ) != 0 ) return FAILURE;
+  if ( s->coalesce != NULL ) ret = flush_batch(s, session_timeout(s, YES));
+  mutex_unlock( &(s->co_mutex) );
+  return ret;
+}
+
+
+//linger 0 flushes the pending batch and goes back to one message for each write
+int change_coalescing(session* s, unsigned long linger){
+
+  const u32 size = READ_ONCE(s->curr_size);
+  int ret = SUCCESS;
+  char* buf = NULL;
+
+  if ( linger > LMS_LINGER_MAX_MS ) return FAILURE;
+  if ( linger != 0 && LMS_COALESCED_SIZE(1, 1) > size ) return FAILURE;
+  if ( mutex_lock_interruptible( &(s->co_mutex) ) != 0 ) return FAILURE;
+  if ( linger == 0 && s->coalesce != NULL ){
+    ret = flush_batch(s, session_timeout(s, YES));
+    if ( ret == SUCCESS ){
+      buf = s->coalesce;
+      WRITE_ONCE(s->coalesce, NULL);
+    }
+  }
+  else if ( linger != 0 && s->coalesce == NULL ){
+    s->coalesce = kvzalloc(size, GFP_KERNEL);
+    if ( s->coalesce == NULL ) ret = -ENOMEM;
+    s->co_size = size;
+    s->co_len = sizeof(struct lms_coalesced);
+    s->co_count = 0;
+  }
+  if ( ret == SUCCESS ) WRITE_ONCE(s->linger, linger);
+  mutex_unlock( &(s->co_mutex) );
+  //the work takes co_mutex, it is waited for out of it
+  if ( buf != NULL ){
+    cancel_delayed_work_sync(&s->co_work);
+    kvfree(buf);
+  }
+  return ret;
+}
+
+
+//close: the last batch waits for space like a write, if it still fails its records are lost
+void coalesce_release(session* s){
+
+  cancel_delayed_work_sync(&s->co_work);
+  if ( s->coalesce == NULL ) return;
+  mutex_lock( &(s->co_mutex) );
+  if ( flush_batch(s, session_timeout(s, YES)) != SUCCESS ) stat_reject(s->slot, s->co_len, FAILURE);
+  mutex_unlock( &(s->co_mutex) );
+  kvfree(s->coalesce);
+  s->coalesce = NULL;
+}
+
+
+ssize_t storage_write_iter(session* s, struct iov_iter* from){
+  if ( READ_ONCE(s->coalesce) != NULL ) return coalesce_write_iter(s, from);
+  return storage_write(s, from, session_timeout(s, YES));
+}
+
+
+ssize_t storage_read_iter(session* s, struct iov_iter* to, batch* b){
+  ssize_t ret;
+  slot_bind_reader(s->slot);
+  session_busy_poll(s);
+  if ( READ_ONCE(s->read_flags) & LMS_READ_PEEK ){
+    if ( READ_ONCE(s->slot->storage) == STORAGE_BROADCAST ) return FAILURE;
+    return peek_read_iter(s, to, b);
+  }
+  switch ( READ_ONCE(s->slot->storage) ){
+    case STORAGE_RING:
+      return ring_read_iter(s, to, b);
+    case STORAGE_LOCKFREE:
+      return lf_read_iter(s, to, b);
+    case STORAGE_BROADCAST:
+      return bcast_read_iter(s, to, b);
+    default:
+      ret = list_read_iter(s, to, b);
+      spill_refill(s->slot);
+      return ret;
+  }
+}
+
+
+//RECV_BATCH: up to max_msgs messages packed in one buffer plus a length table
+long recv_batch(session* s, struct lms_batch __user* arg){
+
+  ssize_t ret;
+  struct lms_batch req;
+  struct iovec iov;
+  struct iov_iter iter;
+  batch b;
+
+  if ( copy_from_user(&req, arg, sizeof(req)) != 0 || req.max_msgs == 0 ) return FAILURE;
+  if ( import_user_range(READ, u64_to_user_ptr(req.buf), req.buf_len, &iov, &iter) != 0 ) return FAILURE;
+  b.max_msgs = req.max_msgs;
+  b.lens = u64_to_user_ptr(req.lens);
+  b.count = 0;
+  b.records = NO;
+  b.bytes = 0;
+  ret = storage_read_iter(s, &iter, &b);
+  if ( ret < 0 ) return ret;
+  if ( put_user(b.count, &arg->count) != 0 || put_user((u32) ret, &arg->bytes) != 0 ) return FAILURE;
+  return b.count;
+}
+
+
+//PEEK_MESSAGE: metadata of the next message without taking it
+int peek_message(session* s, struct lms_msg_info* info){
+
+  slot_elem* elem = s->slot;
+  message* msg;
+  u32 head;
+  int ret;
+
+  memset(info, 0, sizeof(*info));
+  if ( READ_ONCE(elem->storage) == STORAGE_BROADCAST ) return FAILURE;
+  session_busy_poll(s);
+  slot_lock(elem);
+  ret = wait_for_message(elem, session_timeout(s, NO));
+  if ( ret != SUCCESS ) return ret;
+  if ( elem->storage == STORAGE_LOCKFREE ){
+    //a racing reader may take the message meanwhile, then the slot is empty again
+    if ( !lf_peek(&elem->lf, &info->size) ) ret = FAILURE;
+  }
+  else if ( elem->storage == STORAGE_RING ){
+    head = READ_ONCE(elem->ring.ctrl->head);
+    info->size = READ_ONCE(*(u32*)(elem->ring.data + (head & (elem->ring.size - 1))));
+    //the next read drops a malformed record, there is no message to describe
+    if ( !ring_record_valid(elem, head, smp_load_acquire(&elem->ring.ctrl->tail), info->size) ){
+      info->size = 0;
+      ret = FAILURE;
+    }
+  }
+  else {
+    msg = slot_head(elem);
+    info->size = msg->size;
+    info->prio = __fls(elem->prio_map);
+    info->stamp = msg->stamp;
+  }
+  info->depth = slot_depth(elem);
+  info->free = slot_free(elem);
+  pass_on_readers(elem);
+  slot_unlock(elem);
+  return ret;
+}
+
+
+//FORWARD_MESSAGES: relink the oldest messages of src at the tail of dst, the two locks are
+//always taken in address order so that two opposite forwards cannot deadlock
+int forward_messages(slot_elem* src, slot_elem* dst, u32 max_msgs){
+
+  slot_elem* first = ( src < dst ) ? src : dst;
+  slot_elem* second = ( src < dst ) ? dst : src;
+  message* msg;
+  int prio, moved = 0;
+
+  if ( src == dst ) return FAILURE;
+  slot_lock(first);
+  spin_lock_nested( &(second->queue_lock), SINGLE_DEPTH_NESTING );
+  //the messages on the disk of a spilling destination would come after the forwarded ones
+  if ( src->storage != STORAGE_LIST || dst->storage != STORAGE_LIST || dst->spill.log != NULL ){
+    spin_unlock( &(second->queue_lock) );
+    spin_unlock( &(first->queue_lock) );
+    return FAILURE;
+  }
+  while ( moved < max_msgs && !slot_empty(src) && space_reserve(dst, slot_head(src)->size) ){
+    prio = __fls(src->prio_map);
+    msg = pop_message(src);
+    stat_out(src, msg->size, 0);
+    push_message(dst, msg, prio);
+    stat_in(dst, msg->size);
+    moved++;
+  }
+  if ( moved > 0 ){
+    stat_depth(dst);
+    notify_readers(dst);
+    notify_writers(src);
+  }
+  spin_unlock( &(second->queue_lock) );
+  spin_unlock( &(first->queue_lock) );
+  if ( moved > 0 ) spill_refill(src);
+  return moved;
+}
+
+
+//a slot without a node takes the one of its first reader, the messages queued meanwhile stay where they are
+void slot_bind_reader(slot_elem* elem){
+  if ( READ_ONCE(elem->node) == NUMA_NO_NODE ) cmpxchg(&elem->node, NUMA_NO_NODE, numa_node_id());
+}
+
+
+//CHANGE_SLOT_NODE: new messages come from node, the reserve allocated elsewhere is given back
+int change_slot_node(slot_elem* elem, long node){
+
+  message *pool, *msg;
+  if ( node != LMS_NODE_FIRST_READER && (node < 0 || node >= MAX_NUMNODES || !node_online(node)) ){
+    pr_debug_ratelimited("%s: Error, NUMA node %ld is not online\n", MODNAME, node);
+    return FAILURE;
+  }
+  WRITE_ONCE(elem->node, node == LMS_NODE_FIRST_READER ? NUMA_NO_NODE : node);
+  spin_lock( &(elem->pool_lock) );
+  pool = elem->pool;
+  elem->pool = NULL;
+  elem->pool_count = 0;
+  spin_unlock( &(elem->pool_lock) );
+  while ( pool != NULL ){
+    msg = pool;
+    pool = msg->next;
+    kmem_cache_free( msg_caches[msg->size_class], msg );
+  }
+  return SUCCESS;
+}
+
+
+//CHANGE_OVERFLOW_POLICY: writes already waiting for space keep waiting
+int change_overflow_policy(slot_elem* elem, unsigned long policy){
+  if ( policy > LMS_OVERFLOW_DROP_NEWEST ){
+    pr_debug_ratelimited("%s: Error, unknown overflow policy %lu\n", MODNAME, policy);
+    return FAILURE;
+  }
+  WRITE_ONCE(elem->overflow, policy);
+  return SUCCESS;
+}
+
+
+//CHANGE_SLOT_TTL: the messages already queued are checked against the new value
+int change_slot_ttl(slot_elem* elem, unsigned long ttl_ms){
+  if ( ttl_ms > LMS_TTL_MAX_MS ){
+    pr_debug_ratelimited("%s: Error, time to live %lu ms is over the limit (%u ms)\n", MODNAME, ttl_ms, LMS_TTL_MAX_MS);
+    return FAILURE;
+  }
+  WRITE_ONCE(elem->ttl, (u64) ttl_ms * NSEC_PER_MSEC);
+  return SUCCESS;
+}
+
+
+//account delta bytes of budget against total_budget
+static int budget_reserve(long delta){
+  if ( atomic_long_add_return(delta, &budget_total) > total_budget && total_budget > 0 && delta > 0 ){
+    atomic_long_sub(delta, &budget_total);
+    return NO;
+  }
+  return YES;
+}
+
+
+//bytes a slot takes from total_budget: a ring holds up to its power of two size, not its budget
+static long slot_charge(slot_elem* elem){
+  return ( elem->storage == STORAGE_RING ) ? elem->ring.size : elem->budget;
+}
+
+
+//switch the storage of an empty slot, nobody may be inside the ring paths or map the ring meanwhile
+int change_storage_mode(slot_elem* elem, unsigned long mode){
+
+  int i, status = SUCCESS;
+  void* area = NULL;
+  //the ring stays within the budget, but the largest message allowed has to fit it
+  const u32 ring_size = max( rounddown_pow_of_two(READ_ONCE(elem->budget)), roundup_pow_of_two(LMS_RING_RECORD_SIZE(max_msg_size)) );
+  lf_cell *cells = NULL, *old_cells;
+  message** msgs = NULL;
+
+  if ( mode != STORAGE_LIST && mode != STORAGE_RING && mode != STORAGE_LOCKFREE && mode != STORAGE_BROADCAST ){
+    pr_debug_ratelimited("%s: Error, storage mode parameter value not found!\n",MODNAME);
+    return FAILURE;
+  }
+  if ( mode == STORAGE_RING ){
+    //control page followed by the records, zeroed and ready to be mapped
+    area = vmalloc_user(PAGE_SIZE + ring_size);
+    if ( area == NULL ) return FAILURE;
+    ((struct lms_ring_ctrl*) area)->size = ring_size;
+  }
+  if ( mode == STORAGE_LOCKFREE ){
+    cells = kmalloc_array_node(LF_CELLS, sizeof(lf_cell), GFP_KERNEL, READ_ONCE(elem->node));
+    if ( cells == NULL ) return FAILURE;
+    for ( i = 0 ; i < LF_CELLS ; i++ ) atomic_set( &(cells[i].seq), i );
+  }
+  if ( mode == STORAGE_BROADCAST ){
+    msgs = kmalloc_array_node(BCAST_CELLS, sizeof(message*), GFP_KERNEL, READ_ONCE(elem->node));
+    if ( msgs == NULL ) return FAILURE;
+  }
+  if ( mutex_trylock( &(elem->w_mutex) ) == 0 ){
+    vfree(area);
+    kfree(cells);
+    kfree(msgs);
+    return FAILURE;
+  }
+  if ( mutex_trylock( &(elem->r_mutex) ) == 0 ){
+    mutex_unlock( &(elem->w_mutex) );
+    vfree(area);
+    kfree(cells);
+    kfree(msgs);
+    return FAILURE;
+  }
+  slot_lock(elem);
+  if ( elem->storage != mode ){
+    //a lock free slot is closed last, once nothing else can make the switch fail
+    if ( elem->spill.log != NULL ){
+      pr_debug_ratelimited("%s: Error, a spilling mailslot cannot change storage\n",MODNAME);
+      status = FAILURE;
+    }
+    else if ( !slot_empty(elem) || atomic_read(&elem->ring.mapped) > 0 || elem->ring.producer != NULL || elem->ring.consumer != NULL || !space_close(elem) ){
+      pr_debug_ratelimited("%s: Error, the storage mode of a non empty or mapped mailslot cannot change\n",MODNAME);
+      status = FAILURE;
+    }
+    else if ( !budget_reserve( (( mode == STORAGE_RING ) ? ring_size : elem->budget) - slot_charge(elem) ) ){
+      //space_close succeeded, writers must be able to reserve again
+      if ( elem->storage != STORAGE_RING ) atomic_set( &(elem->free_mem), elem->budget );
+      pr_debug_ratelimited("%s: Error, total_budget exhausted, the ring of %u bytes does not fit\n", MODNAME, ring_size);
+      status = FAILURE;
+    }
+    else {
+      swap(area, elem->ring.ctrl);
+      elem->ring.data = ( elem->ring.ctrl != NULL ) ? (char*) elem->ring.ctrl + PAGE_SIZE : NULL;
+      elem->ring.size = ring_size;
+      elem->ring.readers_waiting = 0;
+      elem->ring.writers_waiting = 0;
+      elem->ring.polled = NO;
+      atomic_set( &(elem->lf.enq), 0 );
+      atomic_set( &(elem->lf.deq), 0 );
+      old_cells = rcu_dereference_protected(elem->lf.cells, lockdep_is_held(&elem->queue_lock));
+      rcu_assign_pointer(elem->lf.cells, cells);
+      cells = old_cells;
+      swap(msgs, elem->bcast.msgs);
+      elem->bcast.head = 0;
+      elem->bcast.tail = 0;
+      elem->bcast.subscribers = 0;
+      //the subscriptions of the previous broadcast period are void
+      if ( mode == STORAGE_BROADCAST ) elem->bcast.gen++;
+      elem->storage = mode;
+      //writers can reserve space from now on
+      if ( mode != STORAGE_RING ) atomic_set( &(elem->free_mem), elem->budget );
+      //broadcast readers sleep until their storage changes too
+      wake_up_interruptible_all(&elem->readers);
+    }
+  }
+  spin_unlock( &(elem->queue_lock) );
+  mutex_unlock( &(elem->r_mutex) );
+  mutex_unlock( &(elem->w_mutex) );
+  vfree(area);
+  kfree(msgs);
+  if ( cells != NULL ){
+    //lock free readers may still look at the old cells
+    synchronize_rcu();
+    kfree(cells);
+  }
+  return status;
+}
+
+
+//resize the byte budget of a slot, the messages already queued have to fit the new one
+//the ring is sized when the slot switches to it, so a ring slot keeps its budget
+int change_slot_budget(slot_elem* elem, unsigned long budget){
+
+  int status = SUCCESS, free;
+  long delta;
+
+  if ( budget < max_msg_size || budget > max_slot_budget ){
+    pr_debug_ratelimited("%s: Error, slot budget has to be in [%d, %d] bytes\n", MODNAME, max_msg_size, max_slot_budget);
+    return FAILURE;
+  }
+  slot_lock(elem);
+  delta = (long) budget - elem->budget;
+  if ( elem->storage == STORAGE_RING ){
+    //the ring may be mapped by user space, it cannot be resized under it
+    pr_debug_ratelimited("%s: Error, the budget of a ring mailslot is fixed by its ring\n", MODNAME);
+    spin_unlock( &(elem->queue_lock) );
+    return FAILURE;
+  }
+  if ( !budget_reserve(delta) ){
+    spin_unlock( &(elem->queue_lock) );
+    return FAILURE;
+  }
+  //writers reserve without the lock, move their counter atomically
+  free = atomic_read( &(elem->free_mem) );
+  do {
+    if ( free + delta < 0 ){
+      status = FAILURE;
+      break;
+    }
+  } while ( !atomic_try_cmpxchg( &(elem->free_mem), &free, free + delta ) );
+
+  if ( status == SUCCESS ){
+    elem->budget = budget;
+    if ( delta > 0 ) notify_writers(elem);
+  }
+  else budget_reserve(-delta);
+  spin_unlock( &(elem->queue_lock) );
+  return status;
+}
+
+
+//a new slot, empty and in the default storage mode, the caller publishes it
+slot_elem* slot_create(int minor){
+
+  slot_elem* elem;
+  if ( !budget_reserve(slot_budget) ){
+    pr_debug_ratelimited("%s: total_budget exhausted, cannot create the mailslot with minor %d\n", MODNAME, minor);
+    return NULL;
+  }
+  elem = kmalloc( sizeof( slot_elem ) , GFP_KERNEL);
+  if ( elem != NULL ){
+    elem->stats = alloc_percpu(slot_stats);
+    if ( elem->stats == NULL ){
+      kfree(elem);
+      elem = NULL;
+    }
+  }
+  if ( elem == NULL ){
+    budget_reserve(-slot_budget);
+    return NULL;
+  }
+  init_waitqueue_head( &(elem->writers) );
+  init_waitqueue_head( &(elem->readers) );
+  memset( elem->head, 0, sizeof(elem->head) );
+  memset( elem->tail, 0, sizeof(elem->tail) );
+  elem->prio_map = 0;
+  elem->budget = slot_budget;
+  atomic_set( &(elem->free_mem), slot_budget );
+  atomic_set( &(elem->msgs), 0 );
+  spin_lock_init( &(elem->queue_lock) );
+  elem->pool = NULL;
+  elem->pool_count = 0;
+  elem->pool_class = size_class(default_msg_size);
+  spin_lock_init( &(elem->pool_lock) );
+  elem->storage = STORAGE_LIST;
+  elem->ring.ctrl = NULL;
+  elem->ring.data = NULL;
+  atomic_set( &(elem->ring.mapped), 0 );
+  elem->ring.producer = NULL;
+  elem->ring.consumer = NULL;
+  elem->ring.readers_waiting = 0;
+  elem->ring.writers_waiting = 0;
+  elem->ring.polled = NO;
+  RCU_INIT_POINTER( elem->lf.cells, NULL );
+  atomic_set( &(elem->lf.enq), 0 );
+  atomic_set( &(elem->lf.deq), 0 );
+  mutex_init( &(elem->w_mutex) );
+  mutex_init( &(elem->r_mutex) );
+  elem->minor = minor;
+  elem->users = 0;
+  elem->hwm = 0;
+  elem->node = NUMA_NO_NODE;
+  elem->overflow = LMS_OVERFLOW_BLOCK;
+  elem->ttl = 0;
+  elem->dropped = NULL;
+  elem->bcast.msgs = NULL;
+  elem->bcast.head = 0;
+  elem->bcast.tail = 0;
+  elem->bcast.subscribers = 0;
+  elem->bcast.gen = 0;
+  elem->debugfs = NULL;
+  elem->spill.log = NULL;
+  elem->spill.head = 0;
+  elem->spill.tail = 0;
+  elem->spill.msgs = 0;
+  mutex_init( &(elem->spill.mutex) );
+  //every field is set, the reserve comes from the node of the slot
+  fill_pool( elem );
+  spill_recover(elem);
+  pr_debug("%s: mailslot with minor %d created\n", MODNAME, minor);
+  return elem;
+}
+
+
+//free a slot and the messages it still holds, saved first when it spills. nobody may reference it anymore
+void slot_destroy(slot_elem* elem){
+
+  message* aux;
+  spill_close(elem);
+  while ( !slot_empty(elem) && elem->storage == STORAGE_BROADCAST ) bcast_unlink(elem);
+  kfree(elem->bcast.msgs);
+  while( elem->dropped != NULL ){
+    aux = elem->dropped;
+    elem->dropped = aux->next;
+    free_message(elem, aux);
+  }
+  while( elem->prio_map != 0 ){
+    aux = pop_message(elem);
+    free_message(elem, aux);
+  }
+  while ( lf_pop(elem, SIZE_MAX, &aux) == SUCCESS ) free_message(elem, aux);
+  kfree( rcu_access_pointer(elem->lf.cells) );
+  drain_pool(elem);
+  vfree(elem->ring.ctrl);
+  budget_reserve(-slot_charge(elem));
+  free_percpu(elem->stats);
+  kfree(elem);
+}
+
+
+//check the size parameters and create the message caches, before any slot exists
+int lms_core_init(void){
+  int i;
+  //every message allowed has to fit an empty slot
+  if ( max_msg_size <= 0 || max_msg_size > MSG_SIZE_LIMIT || default_msg_size <= 0 || default_msg_size > max_msg_size ||
+       max_slot_budget > SLOT_BUDGET_LIMIT || slot_budget < max_msg_size || slot_budget > max_slot_budget ){
+    printk(KERN_INFO"%s: inconsistent size parameters, 0 < default_msg_size <= max_msg_size <= %d and max_msg_size <= slot_budget <= max_slot_budget <= %d\n",
+           MODNAME, MSG_SIZE_LIMIT, SLOT_BUDGET_LIMIT);
+    return -EINVAL;
+  }
+  //message caches first, every slot reserve comes from them
+  for (i = 0 ; i < NUM_SIZE_CLASSES ; i++){
+    msg_caches[i] = kmem_cache_create( msg_cache_names[i], sizeof(message) + (MIN_CLASS_SIZE << i), 0, SLAB_HWCACHE_ALIGN, NULL );
+    if ( msg_caches[i] == NULL ){
+      printk(KERN_INFO"%s: cannot create the message cache %s , failed ", MODNAME, msg_cache_names[i]);
+      while ( --i >= 0 ) kmem_cache_destroy( msg_caches[i] );
+      return -ENOMEM;
+    }
+  }
+  return SUCCESS;
+}
+
+
+//every slot has to be destroyed already
+void lms_core_exit(void){
+  int i;
+  for (i = 0 ; i < NUM_SIZE_CLASSES ; i++) kmem_cache_destroy( msg_caches[i] );
+}
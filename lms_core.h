@@ -0,0 +1,332 @@
+#ifndef LMS_CORE_H
+#define LMS_CORE_H
+
+/*
+queue, accounting and wakeup engine of the mailslots. the char device (lms_dev.c) is a thin
+layer over it, and the same sources build in user space for benchmarking (lms_bench.c)
+with lms_stub.h standing in for the kernel primitives
+*/
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/uio.h>
+#include <linux/poll.h>
+#include <linux/rcupdate.h>
+#include <linux/bitops.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/jiffies.h>
+#include <linux/workqueue.h>
+#include <linux/version.h>
+
+//import_single_range is gone from 6.5 on, a single user buffer is an ITER_UBUF iterator
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+#define import_user_range(rw, buf, len, iov, i) ((void) (iov), import_ubuf(rw, buf, len, i))
+#else
+#define import_user_range(rw, buf, len, iov, i) import_single_range(rw, buf, len, iov, i)
+#endif
+
+//wait.h has no exclusive interruptible wait with a timeout, this is wait_event_interruptible_timeout
+//queueing the task at the tail as an exclusive waiter
+#define wait_event_interruptible_exclusive_timeout(wq_head, condition, timeout)                    \
+({                                                                                                \
+  long __ret = timeout;                                                                           \
+  might_sleep();                                                                                  \
+  if ( !___wait_cond_timeout(condition) )                                                         \
+    __ret = ___wait_event(wq_head, ___wait_cond_timeout(condition), TASK_INTERRUPTIBLE, 1,        \
+                          timeout, __ret = schedule_timeout(__ret));                              \
+  __ret;                                                                                          \
+})
+#else
+#include "lms_stub.h"
+#endif
+
+#include "LinuxMailSlots.h"
+
+#define MODNAME "LINUXMAILSLOT"
+
+//module tunable parameters and const
+#define MAX_MESSAGE_SIZE 512   //defaults of the module parameters
+#define INIT_MESSAGE_SIZE 256
+#define MAX_SLOT_SIZE 128
+#define MSG_SIZE_LIMIT (16 << 20)   //hard limits of the module parameters
+#define SLOT_BUDGET_LIMIT (1 << 30)
+#define MIN_CLASS_SIZE 64   //smallest message slab class, the others double up to 4096
+#define NUM_SIZE_CLASSES 7  //64 128 256 512 1024 2048 4096
+#define LARGE_CLASS NUM_SIZE_CLASSES  //bigger messages are page vectors
+#define LF_CELLS 1024       //lock free storage, messages queued at most (power of two)
+#define SPACE_CLOSED INT_MIN  //free_mem of a ring slot, the ring indexes do the accounting
+#define BCAST_CELLS 1024    //broadcast storage, messages kept at most (power of two)
+#define NO 0
+#define YES 1
+#define NON_BLOCKING 0
+#define BLOCKING 1
+#define HIST_BUCKETS 32     //log2 histograms, bucket b counts the samples below 2^b ns
+
+//mudule error codes
+#define SUCCESS 0
+#define FAILURE -1
+#define MSOPEN_ERROR -1
+#define MSWRITE_ERROR -2
+#define MSREAD_ERROR -3
+#define MSPUSH_ERROR -4
+#define NOT_ENOUGH_SPACE_ERROR -5
+#define TIMEOUT_ERROR -ETIMEDOUT   //a read or write timeout of the session expired, errno is ETIMEDOUT
+#define MSG_DROPPED 1   //the overflow policy discarded the message of a write
+
+//message, header and payload live in the same object of a size class slab cache.
+//a LARGE_CLASS payload is a vector of single pages, the header and the page table are kvmalloc'ed,
+//so a message of some MiB never needs a high order allocation
+typedef struct Message{
+  struct Message* next;
+  size_t size;
+  int size_class;   //index of the cache the object belongs to
+  int refs;         //STORAGE_BROADCAST: the ring and the readers copying it out
+  u64 stamp;        //enqueue time in ns, for the latency histogram
+  u32 nr_pages;     //LARGE_CLASS: pages of the payload, their table is in place of the payload
+  u32 pending;      //STORAGE_BROADCAST: subscribers that did not read it yet
+  int prio;         //STORAGE_LIST: level of the message, a failed read links it back there
+  struct page** pages;
+  char payload[];
+} message;
+
+
+//contiguous storage, length prefixed records laid out back to back (see LinuxMailSlots.h)
+typedef struct Ring{
+  struct lms_ring_ctrl* ctrl; //first page of the area, head and tail live here and are shared with the mappings
+  char* data;                 //the records, right after the control page
+  u32 size;                   //power of two
+  atomic_t mapped;            //live mappings of the area
+  struct file* producer;      //files that took a side of the ring for user space access
+  struct file* consumer;
+  int readers_waiting;        //sleepers, mirrored in the control page
+  int writers_waiting;
+  int polled;                 //somebody polls the slot, user space has to notify every change
+} ring;
+
+//how the messages of a batch read are laid out in the destination
+typedef struct Batch{
+  u32 max_msgs;       //messages to take at most
+  u32 __user* lens;   //packed layout: payloads back to back and their length here, NULL means one message per iovec segment
+  u32 count;          //messages taken
+  int records;        //readv of several segments: one buffer of ring records, the length in front of each payload
+  size_t bytes;       //records: bytes of the records taken
+} batch;
+
+//lock free storage: bounded MPMC queue of message pointers, the sequence number of a cell
+//tells whether it is free for the enqueue of position pos (seq == pos) or holds its message (seq == pos+1)
+typedef struct Lf_cell{
+  atomic_t seq;
+  u32 size;         //size of msg, checked by a reader before taking the cell
+  message* msg;
+} lf_cell;
+
+typedef struct Lf_queue{
+  lf_cell __rcu* cells;   //LF_CELLS cells, freed only after a grace period
+  atomic_t enq ____cacheline_aligned_in_smp;  //writers and readers do not share a cache line
+  atomic_t deq ____cacheline_aligned_in_smp;
+} lf_queue;
+
+//broadcast storage: the messages in a ring of pointers indexed by sequence number, every
+//subscribed session keeps the sequence number of its next message. under queue_lock
+typedef struct Bcast{
+  message** msgs;   //BCAST_CELLS pointers
+  u64 head;         //oldest message kept
+  u64 tail;         //sequence number of the next message
+  int subscribers;
+  u32 gen;          //bumped when the slot enters the storage, older subscriptions are void
+} bcast;
+
+//spill log of a list slot (CHANGE_SPILL), the records between head and tail are on disk and
+//come back in order as the readers make room. under spill.mutex, msgs is also read without it
+typedef struct Spill{
+  struct file* log;     //NULL when the slot does not spill
+  loff_t head;          //next record to read back
+  loff_t tail;          //end of the last complete record
+  u32 msgs;             //records on disk
+  struct mutex mutex;   //writers appending and readers reading back, taken before queue_lock
+} spill;
+
+//a file call on spill_dir run by a kworker (spill_call), the caller sleeps until it is done
+typedef struct SpillJob{
+  struct work_struct work;
+  void (*call)(struct SpillJob* job);
+  struct file* f;       //the file of the call, or the one it opened
+  const char* path;
+  int flags;
+  void* buf;
+  size_t len;
+  loff_t* pos;          //read and write: moved past the bytes done
+  loff_t size;          //truncate: new length
+  int write;
+  long ret;
+} spill_job;
+
+//per cpu counters of a slot, summed up when the debugfs file is read
+typedef struct Slot_stats{
+  u64 msgs_in;
+  u64 bytes_in;
+  u64 msgs_out;
+  u64 bytes_out;
+  u64 eagain;           //non blocking calls that found the slot full or empty
+  u64 blocked_writers;  //sleeps waiting for space
+  u64 blocked_readers;  //sleeps waiting for a message
+  u64 contended;        //queue_lock found taken
+  u64 alloc_local;      //new messages on the node of the slot (of the writer while the slot has none)
+  u64 alloc_remote;     //new messages the allocator had to place elsewhere
+  u64 dropped;          //messages discarded by the overflow policy
+  u64 expired;          //messages discarded because older than the time to live
+  u64 lagged;           //broadcast messages a subscriber missed because they were pushed out
+  u64 coalesced;        //records written inside a batch (CHANGE_COALESCING)
+  u64 spin_hits;        //busy polls that saw a message arrive
+  u64 spin_misses;      //busy polls that ran out of budget, the reader went to sleep
+  u64 wakeups_skipped;  //notifications with nobody in the wait queue
+  u64 spilled;          //messages appended to the spill log
+  u64 latency[HIST_BUCKETS];  //enqueue to dequeue, ring records are not stamped
+  u64 sleep[HIST_BUCKETS];    //time spent in the wait queues
+} slot_stats;
+
+//mailslot element
+typedef struct Slot_elem{
+  wait_queue_head_t writers;  //blocked writers, exclusive and FIFO, pollers waiting for EPOLLOUT
+  wait_queue_head_t readers;  //blocked readers, exclusive and FIFO, pollers waiting for EPOLLIN
+  message* head[LMS_PRIO_LEVELS];  //list storage: one FIFO for each priority level
+  message* tail[LMS_PRIO_LEVELS];
+  unsigned long prio_map;           //bit p set when level p is not empty
+  atomic_t free_mem;    //bytes of the budget not reserved by a writer, see space_reserve
+  atomic_t msgs;        //messages linked in the slot, out of the ring storage
+  spinlock_t queue_lock;
+  message* pool;    //reserve of preallocated messages of class pool_class
+  int pool_count;
+  int pool_class;
+  spinlock_t pool_lock;
+  int storage;          //STORAGE_LIST, STORAGE_RING or STORAGE_LOCKFREE
+  ring ring;
+  lf_queue lf;
+  bcast bcast;
+  struct mutex w_mutex; //ring storage: one writer and one reader copy at a time
+  struct mutex r_mutex;
+  int minor;
+  int users;            //open files and mappings, under slots_mutex
+  int budget;           //bytes of messages the slot may hold, under queue_lock
+  slot_stats __percpu* stats;
+  int hwm;              //high water mark of the queued bytes
+  struct dentry* debugfs;
+  int node;             //NUMA node of the memory of the slot, NUMA_NO_NODE until the first read
+  int overflow;         //LMS_OVERFLOW_* policy
+  u64 ttl;              //time to live of the messages in ns, 0 means forever
+  message* dropped;     //discarded under queue_lock, freed by slot_unlock
+  spill spill;
+} slot_elem;
+
+//per open file state: the run time behavior of an I/O session, set through ioctl
+typedef struct Session{
+  slot_elem* slot;
+  struct file* filp;
+  int blocking;         //BLOCKING or NON_BLOCKING, O_NONBLOCK on the file always wins
+  ssize_t curr_size;    //largest message this session may write
+  int prio;             //priority level of the messages written by this session
+  int read_flags;       //LMS_READ_* flags
+  unsigned int r_timeout;   //ms a blocking read may wait for a message, 0 means forever
+  unsigned int w_timeout;   //ms a blocking write may wait for space, 0 means forever
+  unsigned int busy_poll;   //us a blocking read spins on an empty slot before sleeping
+  u64 cursor;           //STORAGE_BROADCAST: sequence number of the next message to read
+  u32 bcast_gen;        //subscribed while equal to the bcast.gen of the slot
+  char* coalesce;       //CHANGE_COALESCING: batch being filled, NULL when off
+  u32 co_size;          //size of the batch buffer, the message size when coalescing started
+  u32 co_len;           //bytes of header and records in the buffer
+  u32 co_count;         //records in the buffer
+  unsigned int linger;  //ms the first record of a batch may wait
+  struct mutex co_mutex;      //serializes the writers of the session and the linger work
+  struct delayed_work co_work;
+} session;
+
+//allocator counters, exported through GET_ALLOC_STATS
+struct alloc_counters{
+  atomic_long_t pool_hits;
+  atomic_long_t slab_allocs;
+  atomic_long_t alloc_failures;
+  atomic_long_t pool_frees;
+  atomic_long_t slab_frees;
+};
+
+//module parameters, see lms_core.c
+extern int slot_reserve;
+extern int max_msg_size;
+extern int default_msg_size;
+extern int slot_budget;
+extern int max_slot_budget;
+extern long total_budget;
+extern char* spill_dir;
+extern long spill_max;
+extern struct alloc_counters alloc_stats;
+
+//functions declaration
+int lms_core_init(void);
+void lms_core_exit(void);
+slot_elem* slot_create(int minor);
+void slot_destroy(slot_elem* elem);
+void slot_lock(slot_elem* elem);
+void slot_unlock(slot_elem* elem);
+void stat_in(slot_elem* elem, size_t len);
+void stat_out(slot_elem* elem, size_t len, u64 stamp);
+void stat_reject(slot_elem* elem, size_t size, int err);
+void stat_depth(slot_elem* elem);
+void notify_readers(slot_elem* elem);
+void notify_writers(slot_elem* elem);
+void pass_on_readers(slot_elem* elem);
+void pass_on_writers(slot_elem* elem);
+int session_blocking(session* s);
+void session_busy_poll(session* s);
+long session_timeout(session* s, int writer);
+int space_reserve(slot_elem* elem, int len);
+void space_cancel(slot_elem* elem, int len);
+message* alloc_message(slot_elem* elem, size_t len);
+void free_message(slot_elem* elem, message* msg);
+int msg_copy_from_user(message* msg, const char __user* buff, size_t len);
+int msg_copy_to_user(message* msg, char __user* buff);
+void push_message(slot_elem* elem, message* msg, int prio);
+message* slot_head(slot_elem* elem);
+message* pop_message(slot_elem* elem);
+int slot_empty(slot_elem* elem);
+int slot_free(slot_elem* elem);
+int slot_depth(slot_elem* elem);
+void ring_sleepers(slot_elem* elem, int readers, int writers);
+int wait_for_space(slot_elem* elem, int needed, long timeout);
+int wait_for_message(slot_elem* elem, long timeout);
+int make_room(slot_elem* elem, int needed, long timeout);
+void slot_unclaim(slot_elem* elem, int needed);
+ssize_t single_write(session* s, const char* buff, size_t len);
+ssize_t single_read(session* s, char* buff, size_t len);
+ssize_t storage_write_iter(session* s, struct iov_iter* from);
+ssize_t storage_read_iter(session* s, struct iov_iter* to, batch* b);
+long recv_batch(session* s, struct lms_batch __user* arg);
+int peek_message(session* s, struct lms_msg_info* info);
+int forward_messages(slot_elem* src, slot_elem* dst, u32 max_msgs);
+void coalesce_init(session* s);
+int coalesce_flush(session* s);
+int change_coalescing(session* s, unsigned long linger);
+void coalesce_release(session* s);
+void bcast_subscribe(session* s);
+void bcast_unsubscribe(session* s);
+int bcast_ready(session* s);
+void slot_bind_reader(slot_elem* elem);
+int change_slot_node(slot_elem* elem, long node);
+int change_overflow_policy(slot_elem* elem, unsigned long policy);
+int change_slot_ttl(slot_elem* elem, unsigned long ttl_ms);
+int change_storage_mode(slot_elem* elem, unsigned long mode);
+int change_slot_budget(slot_elem* elem, unsigned long budget);
+int change_spill(slot_elem* elem, unsigned long on);
+void spill_refill(slot_elem* elem);
+
+#endif
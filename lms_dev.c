@@ -0,0 +1,819 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/sched.h>
+#include <linux/pid.h>
+#include <linux/version.h>
+#include <linux/slab.h>
+#include <linux/device.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/xarray.h>
+#include <linux/debugfs.h>
+#include <linux/file.h>
+#include <linux/splice.h>
+#include <linux/seq_file.h>
+
+#include "lms_core.h"
+
+//the mailslots are looked up in an xarray
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 20, 0)
+#error "LinuxMailSlots needs a 4.20 or later kernel"
+#endif
+
+MODULE_AUTHOR("Francesco Segala - francesco.segala10@gmial.com");
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("this project deals with implementing within Linux services similar to those that are offered by Windows mail slots");
+/*spec*/
+/*
+This specification related the implementation of a special device file that is accessible according to FIFO style semantic
+(via open/close/read/write services), but offering an execution semantic of read/write services such that any segment that is
+ posted to the stream associated with the file is seen as an independent data unit (a message), thus being posted and delivered
+ atomically (all or nothing) and in data separation (with respect to other segments) to the reading threads.
+The device file needs to be multi-instance (by having the possibility to manage at least 256 different instances) so that mutiple
+ FIFO style streams (characterized by the above semantic) can be concurrently accessed by active processes/threads.
+
+The device file needs to also support ioctl commands in order to define the run time behavior of any I/O session
+ targeting it (such as whether read and/or write operations on a session need to be performed according to blocking or non-blocking rules).
+
+Parameters that are left to the designer, which should be selected via reasonable policies, are:
+
+the maximum size of managed data-units (this might also be made tunable via ioctl up to an absolute upper limit)
+the maximum storage that can be (dynamically) reserved for any individual mail slot
+the range of device file minor numbers supported by the driver (it could be the interval [0-255] or not)
+*/
+#define DEVICE_NAME "mail_slot"
+
+#define MAX_MINOR_NUM 256  //default minor range [0, MAX_MINOR_NUM), see max_minors
+
+//
+static int major_number = 0;
+//the mailslots in use indexed by minor, a slot is created by its first open
+static DEFINE_XARRAY(mailslots);
+static DEFINE_MUTEX(slots_mutex);
+//debugfs directory, one statistics file for each live slot
+static struct dentry* lms_debugfs;
+
+//minors handled by the driver, [0, max_minors)
+static int max_minors = MAX_MINOR_NUM;
+module_param(max_minors, int, S_IRUGO);
+MODULE_PARM_DESC(max_minors, "number of mailslot instances (minor numbers) of the device");
+
+//functions declaration
+static int lms_open(struct inode *inode , struct file *file);
+static int lms_release(struct inode *inode, struct file *file);
+static ssize_t lms_write(struct file *filp, const char *buff, size_t len, loff_t *off);
+static ssize_t lms_read(struct file *filp, char *buff, size_t len, loff_t *off);
+static long lms_ioctl( struct file *, unsigned int , unsigned long );
+static ssize_t lms_write_iter(struct kiocb *iocb, struct iov_iter *from);
+static ssize_t lms_read_iter(struct kiocb *iocb, struct iov_iter *to);
+static __poll_t lms_poll(struct file *filp, poll_table *wait);
+static int lms_mmap(struct file *filp, struct vm_area_struct *vma);
+static void ring_unclaim(slot_elem* elem, struct file* filp);
+static slot_elem* slot_get(int minor);
+static void slot_put(slot_elem* elem);
+static struct file_operations fops;
+
+
+static int lms_open(struct inode *inode, struct file *file){
+  session* s;
+  slot_elem* elem;
+  const int MINOR_CURRENT = iminor(inode);
+  if (MINOR_CURRENT<0 || MINOR_CURRENT >= max_minors ){
+    pr_debug_ratelimited("%s: Cannot open the device, minor number %d not allowed\n", MODNAME, MINOR_CURRENT);
+    return MSOPEN_ERROR;
+  }
+  elem = slot_get(MINOR_CURRENT);
+  if ( elem == NULL ) return -ENOMEM;
+  //every open is a new I/O session with the default behavior
+  s = kmalloc( sizeof(session), GFP_KERNEL );
+  if ( s == NULL ){
+    slot_put(elem);
+    return -ENOMEM;
+  }
+  s->slot = elem;
+  s->filp = file;
+  s->blocking = BLOCKING;
+  s->curr_size = default_msg_size;
+  s->prio = 0;
+  s->read_flags = 0;
+  s->r_timeout = 0;
+  s->w_timeout = 0;
+  s->busy_poll = 0;
+  s->bcast_gen = 0;
+  coalesce_init(s);
+  file->private_data = s;
+  if ( file->f_mode & FMODE_READ ) bcast_subscribe(s);
+
+  pr_debug("%s: Device opened and new LMS instance created with minor %d\n", MODNAME, MINOR_CURRENT);
+  return SUCCESS;
+}
+
+
+static int lms_release(struct inode *inode, struct file *file){
+  session* s = file->private_data;
+  const int MINOR_CURRENT = iminor(inode);
+  coalesce_release(s);
+  ring_unclaim(s->slot, file);
+  bcast_unsubscribe(s);
+  slot_put(s->slot);
+  kfree(s);
+  pr_debug("%s: Device closing...closed a LMS instance with minor %d\n", MODNAME, MINOR_CURRENT );
+  return SUCCESS;
+}
+
+
+//snapshot of the settings and the occupancy of the slot seen by a session
+static int get_slot_info(session* s, struct lms_slot_info __user* arg){
+
+  struct lms_slot_info info;
+  slot_elem* elem = s->slot;
+
+  slot_lock(elem);
+  info.budget = elem->budget;
+  info.free = slot_free(elem);
+  info.storage = elem->storage;
+  slot_unlock(elem);
+  info.minor = elem->minor;
+  info.msg_size = READ_ONCE(s->curr_size);
+  info.max_msg_size = max_msg_size;
+  info.blocking = session_blocking(s);
+  info.prio = READ_ONCE(s->prio);
+  info.node = READ_ONCE(elem->node);
+  info.overflow = READ_ONCE(elem->overflow);
+  info.ttl_ms = div_u64(READ_ONCE(elem->ttl), NSEC_PER_MSEC);
+  info.r_timeout_ms = READ_ONCE(s->r_timeout);
+  info.w_timeout_ms = READ_ONCE(s->w_timeout);
+  info.subscribers = READ_ONCE(elem->bcast.subscribers);
+  info.linger_ms = READ_ONCE(s->linger);
+  info.busy_poll_us = READ_ONCE(s->busy_poll);
+  info.msgs = max(atomic_read(&elem->msgs), 0);
+  info.spilling = READ_ONCE(elem->spill.log) != NULL;
+  info.spilled = READ_ONCE(elem->spill.msgs);
+  if ( copy_to_user(arg, &info, sizeof(info)) != 0 ) return FAILURE;
+  return SUCCESS;
+}
+
+
+//struct fd is opaque from 6.12 on, fd_file is its accessor
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 12, 0)
+#define fd_file(f) ((f).file)
+#endif
+
+//FORWARD_MESSAGES: the destination file has to be a mailslot, its reference keeps the slot alive
+static int forward_to(session* s, struct lms_forward __user* arg){
+
+  struct lms_forward req;
+  struct fd f;
+  session* dst;
+  int ret;
+
+  if ( copy_from_user(&req, arg, sizeof(req)) != 0 ) return FAILURE;
+  f = fdget(req.fd);
+  if ( fd_file(f) == NULL ) return FAILURE;
+  if ( fd_file(f)->f_op != &fops ){
+    fdput(f);
+    return FAILURE;
+  }
+  dst = fd_file(f)->private_data;
+  ret = forward_messages(s->slot, dst->slot, req.max_msgs);
+  fdput(f);
+  return ret;
+}
+
+
+//give one side of the ring to user space, from now on read or write on that side only go through the mapping
+static int ring_claim(slot_elem* elem, struct file* filp, unsigned long side){
+
+  int status = SUCCESS;
+  struct mutex* side_mutex = ( side == RING_PRODUCER ) ? &(elem->w_mutex) : &(elem->r_mutex);
+
+  if ( side != RING_PRODUCER && side != RING_CONSUMER ) return FAILURE;
+  //wait for a kernel copy in flight on that side
+  if ( mutex_lock_interruptible(side_mutex) != 0 ) return FAILURE;
+  slot_lock(elem);
+  if ( elem->storage != STORAGE_RING ) status = FAILURE;
+  else if ( side == RING_PRODUCER && elem->ring.producer == NULL ) elem->ring.producer = filp;
+  else if ( side == RING_CONSUMER && elem->ring.consumer == NULL ) elem->ring.consumer = filp;
+  else status = FAILURE;
+  slot_unlock(elem);
+  mutex_unlock(side_mutex);
+  return status;
+}
+
+
+static void ring_unclaim(slot_elem* elem, struct file* filp){
+  slot_lock(elem);
+  if ( elem->ring.producer == filp ) elem->ring.producer = NULL;
+  if ( elem->ring.consumer == filp ) elem->ring.consumer = NULL;
+  slot_unlock(elem);
+}
+
+
+//user space producers and consumers only enter the kernel to sleep or to wake the other side up
+static int ring_wait(session* s, unsigned int param, unsigned long value){
+
+  slot_elem* elem = s->slot;
+  int ret;
+  slot_lock(elem);
+  if ( elem->storage != STORAGE_RING ){
+    slot_unlock(elem);
+    return FAILURE;
+  }
+  switch (param) {
+    case RING_WAIT_READABLE:
+      ret = wait_for_message(elem, session_timeout(s, NO));
+      break;
+    case RING_WAIT_WRITABLE:
+      if ( value == 0 || value > elem->ring.size ){
+        slot_unlock(elem);
+        return FAILURE;
+      }
+      ret = wait_for_space(elem, value, session_timeout(s, YES));
+      //only a ring slot leaves the space to the caller, a slot switched meanwhile reserved it
+      if ( ret == SUCCESS && elem->storage != STORAGE_RING ){
+        slot_unclaim(elem, value);
+        ret = FAILURE;
+        slot_unlock(elem);
+      }
+      break;
+    default:
+      //RING_NOTIFY: records were published or released through the mapping
+      notify_readers(elem);
+      notify_writers(elem);
+      ret = SUCCESS;
+      break;
+  }
+  if ( ret != SUCCESS ) return ret;
+  slot_unlock(elem);
+  return SUCCESS;
+}
+
+
+//a mapping keeps the slot alive after the file is closed
+static void lms_vm_open(struct vm_area_struct* vma){
+  slot_elem* elem = vma->vm_private_data;
+  atomic_inc( &elem->ring.mapped );
+  mutex_lock( &slots_mutex );
+  elem->users++;
+  mutex_unlock( &slots_mutex );
+}
+
+
+static void lms_vm_close(struct vm_area_struct* vma){
+  slot_elem* elem = vma->vm_private_data;
+  atomic_dec( &elem->ring.mapped );
+  slot_put(elem);
+}
+
+
+static const struct vm_operations_struct lms_vm_ops = {
+  .open = lms_vm_open,
+  .close = lms_vm_close
+};
+
+
+//map the control page and the records of a ring slot, the area stays allocated while mapped
+static int lms_mmap(struct file *filp, struct vm_area_struct *vma){
+
+  int ret;
+  session* s = filp->private_data;
+  slot_elem* elem = s->slot;
+  const unsigned long size = vma->vm_end - vma->vm_start;
+
+  if ( !(vma->vm_flags & VM_SHARED) || vma->vm_pgoff != 0 ) return -EINVAL;
+  //the ring cannot be replaced while the mutexes are held
+  if ( mutex_lock_interruptible( &(elem->w_mutex) ) != 0 ) return -ERESTARTSYS;
+  mutex_lock( &(elem->r_mutex) );
+  if ( elem->storage != STORAGE_RING || size > PAGE_SIZE + elem->ring.size ){
+    ret = -EINVAL;
+  }
+  else {
+    ret = remap_vmalloc_range(vma, elem->ring.ctrl, 0);
+    if ( ret == 0 ){
+      vma->vm_ops = &lms_vm_ops;
+      vma->vm_private_data = elem;
+      lms_vm_open(vma);
+    }
+  }
+  mutex_unlock( &(elem->r_mutex) );
+  mutex_unlock( &(elem->w_mutex) );
+  return ret;
+}
+
+
+
+static ssize_t lms_write(struct file *filp, const char *buff, size_t len, loff_t *off){
+
+  message *msg;
+  int ret, reserved;
+  session* s = filp->private_data;
+  slot_elem* elem = s->slot;
+
+  if ( len > READ_ONCE(s->curr_size)  || len <= 0 ){
+    pr_debug_ratelimited("%s: lms_write error, len %zu to write not compliant with the spec\n", MODNAME, len);
+    stat_reject(elem, len, FAILURE);
+    return FAILURE;
+  }
+  if ( READ_ONCE(elem->storage) != STORAGE_LIST || READ_ONCE(s->coalesce) != NULL || READ_ONCE(elem->spill.log) != NULL ) return single_write(s, buff, len);
+
+  //allocate and fill the message before locking, copy_from_user may sleep
+  msg = alloc_message( elem, len );
+  if ( msg == NULL ){
+    pr_debug_ratelimited("%s: Error while allocating memory for pushing a new message for the entry %d\n", MODNAME, elem->minor);
+    stat_reject(elem, len, MSPUSH_ERROR);
+    return MSPUSH_ERROR;
+  }
+  if ( msg_copy_from_user(msg, buff, len) != SUCCESS ){ //Copy a block of data from user space memory to kernel memory (to,from,len)
+    free_message( elem, msg );
+    return FAILURE;
+  }
+  msg->size = len;
+  msg->stamp = ktime_get_ns();
+
+  //reserve the space before locking, only a full slot goes through make_room under the lock.
+  //a writer sleeping for space is served first, a lockless reservation would overtake it
+  reserved = !wq_has_sleeper(&elem->writers) && space_reserve( elem, len );
+
+  //lock the mailslot elem
+  slot_lock(elem);
+
+  if ( !reserved ){
+    ret = make_room( elem, len, session_timeout(s, YES) );
+    if ( ret != SUCCESS ){
+      free_message( elem, msg );
+      return ( ret == MSG_DROPPED ) ? len : ret;
+    }
+  }
+
+  //once you know you can write your message because there is enough space
+  //push the message to the message queue, its space is already taken
+  //but before check if the storage mode has changed by IOCTL
+  if ( elem->storage != STORAGE_LIST ){
+    //the reservation belongs to the storage the slot switched to
+    if ( reserved ) space_cancel( elem, len );
+    else slot_unclaim( elem, len );
+    pass_on_writers(elem);
+    slot_unlock(elem);
+    free_message( elem, msg );
+    return FAILURE;
+  }
+
+  push_message( elem, msg, READ_ONCE(s->prio) );
+  stat_in(elem, len);
+  stat_depth(elem);
+
+  //awake a reader process that is waiting
+  notify_readers(elem);
+  pass_on_writers(elem);
+  //then release the lock and return the number of byte written
+  slot_unlock(elem);
+  return len;
+}
+
+
+
+static ssize_t lms_read(struct file *filp, char *buff, size_t len, loff_t *off){
+
+  message *msg;
+  session* s = filp->private_data;
+  slot_elem* elem = s->slot;
+  int ret;
+  //check on len : has to be at least the size of the message, PEEK_MESSAGE tells it
+  if ( len <= 0  ){
+    pr_debug_ratelimited("%s: called a read with an empty buffer\n", MODNAME);
+    return FAILURE;
+  }
+  if ( READ_ONCE(elem->storage) != STORAGE_LIST || (READ_ONCE(s->read_flags) & LMS_READ_PEEK) ) return single_read(s, buff, len);
+  slot_bind_reader(elem);
+  session_busy_poll(s);
+
+  //the len of the head message is checked under the lock, the head may change meanwhile
+  slot_lock(elem);
+  //acquire the lock in order to read the message slot
+  ret = wait_for_message( elem, session_timeout(s, NO) );
+  if ( ret != SUCCESS ) return ret;
+  if ( elem->storage != STORAGE_LIST ){
+    //the slot moved to another storage while we were waiting
+    slot_unlock(elem);
+    return single_read(s, buff, len);
+  }
+
+  //check again the len to read after the lock releasing because can be changed
+  if ( len < slot_head(elem)->size  ){
+    stat_reject(elem, slot_head(elem)->size, FAILURE);
+    notify_readers(elem);
+    slot_unlock(elem);
+    pr_debug_ratelimited("%s: called a read with a len not compliant with the message size, the read has to be all or nothing\n", MODNAME );
+    return FAILURE;
+  }
+  //poping the message from the mailslot
+  msg = pop_message(elem);
+  //now the reader has to signal to the writers waiting that there is a new slot ready
+  notify_writers(elem);
+  pass_on_readers(elem);
+  slot_unlock(elem);
+  //the message is not reachable anymore, copy it out of the lock since copy_to_user may sleep
+  len = msg->size;
+  ret = msg_copy_to_user(msg, buff); //put the message into the buffer (to,from.len)
+  if ( ret == SUCCESS ) stat_out(elem, len, msg->stamp);
+  free_message( elem, msg );
+  spill_refill(elem);
+  if ( ret != SUCCESS ) return FAILURE;
+  return len;
+}
+
+
+
+//writev: every iovec segment is one message, delivered all or nothing
+static ssize_t lms_write_iter(struct kiocb *iocb, struct iov_iter *from){
+
+  session* s = iocb->ki_filp->private_data;
+  if ( iov_iter_count(from) == 0 ) return 0;
+  return storage_write_iter(s, from);
+}
+
+
+
+//user space buffers, kernel ones are the pipe pages of a splice
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+#define iter_from_user(i) user_backed_iter(i)
+#else
+#define iter_from_user(i) iter_is_iovec(i)
+#endif
+
+//readv: the segments are one buffer of records, the length of each message in front of it (see
+//LinuxMailSlots.h), and the call returns the bytes of the records. it blocks only for the first one.
+//a single user buffer gets a single message like read. the pages of a splice are one contiguous
+//buffer and the pipe takes the bytes returned as they are, so a splice gets a single message too
+static ssize_t lms_read_iter(struct kiocb *iocb, struct iov_iter *to){
+
+  session* s = iocb->ki_filp->private_data;
+  const int records = iter_from_user(to) && to->nr_segs > 1;
+  batch b = { .max_msgs = records ? U32_MAX : 1, .lens = NULL, .count = 0, .records = records, .bytes = 0 };
+  ssize_t ret;
+
+  if ( iov_iter_count(to) == 0 ) return 0;
+  ret = storage_read_iter(s, to, &b);
+  return ( ret > 0 && records ) ? (ssize_t) b.bytes : ret;
+}
+
+
+
+//readable when a message is queued, writable when a message of the current size fits or the slot spills
+static __poll_t lms_poll(struct file *filp, poll_table *wait){
+
+  __poll_t mask = 0;
+  int needed;
+  session* s = filp->private_data;
+  slot_elem* elem = s->slot;
+
+  poll_wait(filp, &(elem->readers), wait);
+  poll_wait(filp, &(elem->writers), wait);
+  //writers skip the wakeup when the wait queues look empty, pairs with wq_has_sleeper
+  smp_mb();
+  if ( READ_ONCE(elem->storage) == STORAGE_RING ){
+    if ( !elem->ring.polled ){
+      //from now on user space producers and consumers have to notify every change
+      slot_lock(elem);
+      elem->ring.polled = YES;
+      ring_sleepers(elem, 0, 0);
+      slot_unlock(elem);
+    }
+    needed = LMS_RING_RECORD_SIZE(s->curr_size);
+  }
+  else needed = s->curr_size;
+
+  if ( READ_ONCE(elem->storage) == STORAGE_BROADCAST ){
+    //a reading poller is a subscriber, readiness is about its own cursor. a writer must not
+    //subscribe, its cursor would never move and hold back every message of the mailslot
+    if ( filp->f_mode & FMODE_READ ){
+      bcast_subscribe(s);
+      if ( bcast_ready(s) ) mask |= EPOLLIN | EPOLLRDNORM;
+    }
+  }
+  else if ( !slot_empty(elem) ) mask |= EPOLLIN | EPOLLRDNORM;
+  if ( slot_free(elem) >= needed || READ_ONCE(elem->spill.log) != NULL ) mask |= EPOLLOUT | EPOLLWRNORM;
+  return mask;
+}
+
+
+
+static long lms_ioctl( struct file * filp, unsigned int param, unsigned long value){
+
+  int status = SUCCESS ;
+  session* s = filp->private_data;
+  struct lms_alloc_stats stats;
+  struct lms_msg_info info;
+
+  //the session settings belong to this file only, no slot lock is needed to change them
+  switch (param) {
+
+    case CHANGE_BLOCKING_MODE:
+      if (value == BLOCKING || value == NON_BLOCKING){
+        WRITE_ONCE(s->blocking, value);
+        status = SUCCESS;
+      }
+      else {
+        pr_debug_ratelimited("%s: Error, change blocking mode parameter value not found!\n",MODNAME);
+        status = FAILURE;
+      }
+      break ;
+
+    case CHANGE_MESSAGE_SIZE:
+      if ( READ_ONCE(s->coalesce) != NULL ){
+        pr_debug_ratelimited("%s: Error, the message size cannot change while coalescing\n", MODNAME);
+        status = FAILURE;
+      }
+      else if ( value <= max_msg_size && value > 0){
+        WRITE_ONCE(s->curr_size, value);
+        status = SUCCESS;
+      }
+      else {
+        pr_debug_ratelimited("%s: Error, change slot size parameter value not compliant with the spec (MAX %d)\n", MODNAME, max_msg_size );
+        status = FAILURE;
+      }
+      break;
+
+    case CHANGE_WRITE_PRIORITY:
+      if ( value < LMS_PRIO_LEVELS ){
+        WRITE_ONCE(s->prio, value);
+        status = SUCCESS;
+      }
+      else {
+        pr_debug_ratelimited("%s: Error, priority has to be in [0, %d]\n", MODNAME, LMS_PRIO_LEVELS - 1);
+        status = FAILURE;
+      }
+      break;
+
+    case CHANGE_READ_TIMEOUT:
+    case CHANGE_WRITE_TIMEOUT:
+      if ( value <= LMS_TIMEOUT_MAX_MS ){
+        if ( param == CHANGE_READ_TIMEOUT ) WRITE_ONCE(s->r_timeout, value);
+        else WRITE_ONCE(s->w_timeout, value);
+        status = SUCCESS;
+      }
+      else {
+        pr_debug_ratelimited("%s: Error, timeout has to be in [0, %u] ms\n", MODNAME, LMS_TIMEOUT_MAX_MS);
+        status = FAILURE;
+      }
+      break;
+
+    case CHANGE_BUSY_POLL:
+      if ( value <= LMS_BUSY_POLL_MAX_US ){
+        WRITE_ONCE(s->busy_poll, value);
+        status = SUCCESS;
+      }
+      else {
+        pr_debug_ratelimited("%s: Error, busy poll has to be in [0, %u] us\n", MODNAME, LMS_BUSY_POLL_MAX_US);
+        status = FAILURE;
+      }
+      break;
+
+    case CHANGE_COALESCING:
+      status = change_coalescing( s, value );
+      if ( status == FAILURE ) pr_debug_ratelimited("%s: Error, linger has to be in [0, %u] ms and the batch has to fit the message size\n", MODNAME, LMS_LINGER_MAX_MS);
+      break;
+
+    case FLUSH_MESSAGES:
+      status = coalesce_flush( s );
+      break;
+
+    case CHANGE_READ_FLAGS:
+      if ( (value & ~LMS_READ_PEEK) == 0 ){
+        WRITE_ONCE(s->read_flags, value);
+        status = SUCCESS;
+      }
+      else {
+        pr_debug_ratelimited("%s: Error, unknown read flags 0x%lx\n", MODNAME, value);
+        status = FAILURE;
+      }
+      break;
+
+    case PEEK_MESSAGE:
+      status = peek_message( s, &info );
+      if ( status != SUCCESS ) break;
+      if ( value != 0 && copy_to_user( (void __user *) value, &info, sizeof(info) ) != 0 ) return FAILURE;
+      return info.size;
+
+    case GET_SLOT_SIZE:
+      return READ_ONCE(s->curr_size);
+
+    case GET_SLOT_INFO:
+      status = get_slot_info( s, (struct lms_slot_info __user *) value );
+      break;
+
+    case CHANGE_SLOT_BUDGET:
+      status = change_slot_budget( s->slot, value );
+      break;
+
+    case CHANGE_SLOT_NODE:
+      status = change_slot_node( s->slot, (long) value );
+      break;
+
+    case CHANGE_OVERFLOW_POLICY:
+      status = change_overflow_policy( s->slot, value );
+      break;
+
+    case CHANGE_SLOT_TTL:
+      status = change_slot_ttl( s->slot, value );
+      break;
+
+    case CHANGE_SPILL:
+      status = change_spill( s->slot, value );
+      break;
+
+    case GET_ALLOC_STATS:
+      //counters are read without the slot lock
+      stats.pool_hits = atomic_long_read( &alloc_stats.pool_hits );
+      stats.slab_allocs = atomic_long_read( &alloc_stats.slab_allocs );
+      stats.alloc_failures = atomic_long_read( &alloc_stats.alloc_failures );
+      stats.pool_frees = atomic_long_read( &alloc_stats.pool_frees );
+      stats.slab_frees = atomic_long_read( &alloc_stats.slab_frees );
+      stats.pool_available = READ_ONCE( s->slot->pool_count );
+      if ( copy_to_user( (void __user *) value, &stats, sizeof(stats) ) != 0 ) status = FAILURE;
+      break;
+
+    case CHANGE_STORAGE_MODE:
+      status = change_storage_mode( s->slot, value );
+      break;
+
+    case RING_CLAIM:
+      status = ring_claim( s->slot, filp, value );
+      break;
+
+    case RING_WAIT_READABLE:
+    case RING_WAIT_WRITABLE:
+    case RING_NOTIFY:
+      status = ring_wait( s, param, value );
+      break;
+
+    case RECV_BATCH:
+      return recv_batch( s, (struct lms_batch __user *) value );
+
+    case FORWARD_MESSAGES:
+      return forward_to( s, (struct lms_forward __user *) value );
+
+    default:
+      pr_debug_ratelimited("%s: command %u not found\n", MODNAME, param);
+      break;
+  }
+  return status;
+}
+
+
+
+static struct file_operations fops = {
+  .owner = THIS_MODULE,
+  .open =  lms_open,
+  .write = lms_write,
+  .read = lms_read,
+  .write_iter = lms_write_iter,
+  .read_iter = lms_read_iter,
+  .unlocked_ioctl = lms_ioctl,
+  .mmap = lms_mmap,
+  .poll = lms_poll,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+  .splice_read = copy_splice_read,            //one message for each call, through read_iter (see there)
+#else
+  .splice_read = generic_file_splice_read,
+#endif
+  .splice_write = iter_file_splice_write,     //every pipe buffer is a message, through write_iter
+  .release = lms_release
+};
+
+//statistics of a slot, the per cpu counters are summed up without stopping the writers
+static int lms_stats_show(struct seq_file* m, void* v){
+
+  slot_elem* elem = m->private;
+  slot_stats sum, *st;
+  int cpu, i;
+
+  memset(&sum, 0, sizeof(sum));
+  for_each_possible_cpu(cpu){
+    st = per_cpu_ptr(elem->stats, cpu);
+    sum.msgs_in += READ_ONCE(st->msgs_in);
+    sum.bytes_in += READ_ONCE(st->bytes_in);
+    sum.msgs_out += READ_ONCE(st->msgs_out);
+    sum.bytes_out += READ_ONCE(st->bytes_out);
+    sum.eagain += READ_ONCE(st->eagain);
+    sum.blocked_writers += READ_ONCE(st->blocked_writers);
+    sum.blocked_readers += READ_ONCE(st->blocked_readers);
+    sum.contended += READ_ONCE(st->contended);
+    sum.alloc_local += READ_ONCE(st->alloc_local);
+    sum.alloc_remote += READ_ONCE(st->alloc_remote);
+    sum.dropped += READ_ONCE(st->dropped);
+    sum.expired += READ_ONCE(st->expired);
+    sum.lagged += READ_ONCE(st->lagged);
+    sum.coalesced += READ_ONCE(st->coalesced);
+    sum.spin_hits += READ_ONCE(st->spin_hits);
+    sum.spin_misses += READ_ONCE(st->spin_misses);
+    sum.wakeups_skipped += READ_ONCE(st->wakeups_skipped);
+    sum.spilled += READ_ONCE(st->spilled);
+    for ( i = 0 ; i < HIST_BUCKETS ; i++ ){
+      sum.latency[i] += READ_ONCE(st->latency[i]);
+      sum.sleep[i] += READ_ONCE(st->sleep[i]);
+    }
+  }
+  seq_printf(m, "minor %d\nstorage %d\nbudget %d\nhigh_water_mark %d\nnode %d\n", elem->minor, READ_ONCE(elem->storage), READ_ONCE(elem->budget), READ_ONCE(elem->hwm), READ_ONCE(elem->node));
+  seq_printf(m, "free %d\nmsgs %d\n", atomic_read(&elem->free_mem), atomic_read(&elem->msgs));
+  seq_printf(m, "msgs_in %llu\nbytes_in %llu\nmsgs_out %llu\nbytes_out %llu\n", sum.msgs_in, sum.bytes_in, sum.msgs_out, sum.bytes_out);
+  seq_printf(m, "eagain %llu\nblocked_writers %llu\nblocked_readers %llu\nlock_contended %llu\n", sum.eagain, sum.blocked_writers, sum.blocked_readers, sum.contended);
+  seq_printf(m, "alloc_local %llu\nalloc_remote %llu\n", sum.alloc_local, sum.alloc_remote);
+  seq_printf(m, "overflow %d\nttl_ns %llu\ndropped %llu\nexpired %llu\n", READ_ONCE(elem->overflow), READ_ONCE(elem->ttl), sum.dropped, sum.expired);
+  seq_printf(m, "subscribers %d\nlagged %llu\n", READ_ONCE(elem->bcast.subscribers), sum.lagged);
+  seq_printf(m, "coalesced %llu\n", sum.coalesced);
+  seq_printf(m, "spin_hits %llu\nspin_misses %llu\nwakeups_skipped %llu\n", sum.spin_hits, sum.spin_misses, sum.wakeups_skipped);
+  seq_printf(m, "spilling %d\nspilled %llu\non_disk %u\n", READ_ONCE(elem->spill.log) != NULL, sum.spilled, READ_ONCE(elem->spill.msgs));
+  seq_puts(m, "ns_below latency sleep\n");
+  for ( i = 0 ; i < HIST_BUCKETS ; i++ ){
+    if ( sum.latency[i] == 0 && sum.sleep[i] == 0 ) continue;
+    seq_printf(m, "%llu %llu %llu\n", 1ULL << i, sum.latency[i], sum.sleep[i]);
+  }
+  return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lms_stats);
+
+
+//look the slot of a minor up, creating it on first use, and take a reference
+static slot_elem* slot_get(int minor){
+
+  slot_elem* elem;
+  char name[16];
+  mutex_lock( &slots_mutex );
+  elem = xa_load( &mailslots, minor );
+  if ( elem == NULL ){
+    elem = slot_create(minor);
+    if ( elem != NULL && xa_err( xa_store( &mailslots, minor, elem, GFP_KERNEL ) ) != 0 ){
+      slot_destroy(elem);
+      elem = NULL;
+    }
+    else if ( elem != NULL ){
+      snprintf(name, sizeof(name), "%d", minor);
+      elem->debugfs = debugfs_create_file(name, 0444, lms_debugfs, elem, &lms_stats_fops);
+    }
+  }
+  if ( elem != NULL ) elem->users++;
+  mutex_unlock( &slots_mutex );
+  return elem;
+}
+
+
+//drop a reference, an idle slot holding no messages is reclaimed and the next open starts from scratch
+static void slot_put(slot_elem* elem){
+  mutex_lock( &slots_mutex );
+  if ( --elem->users == 0 && slot_empty(elem) ){
+    xa_erase( &mailslots, elem->minor );
+    pr_debug("%s: idle mailslot with minor %d reclaimed\n", MODNAME, elem->minor);
+    debugfs_remove(elem->debugfs);
+    slot_destroy(elem);
+  }
+  mutex_unlock( &slots_mutex );
+}
+
+
+int init_module(void) {
+  //register the chardevice and store the result in major_number
+  int ret;
+  if ( max_minors <= 0 || max_minors > MINORMASK + 1 ){
+    printk(KERN_INFO"%s: max_minors has to be in [1, %d]\n", MODNAME, MINORMASK + 1);
+    return -EINVAL;
+  }
+  ret = lms_core_init();
+  if ( ret != SUCCESS ) return ret;
+  //the slots are created by the first open of each minor, each one adds its statistics here
+  lms_debugfs = debugfs_create_dir(DEVICE_NAME, NULL);
+  major_number = __register_chrdev(0, 0, max_minors, DEVICE_NAME, &fops);
+  if ( major_number < 0 ){
+    printk(KERN_INFO"%s: cannot register a chardevice , failed ", MODNAME);
+    debugfs_remove_recursive(lms_debugfs);
+    lms_core_exit();
+    return major_number;
+  }
+  printk(KERN_INFO "%s: Device registered, it is assigned major number %d with %d minors\n", MODNAME, major_number, max_minors);
+	return SUCCESS;
+}
+
+void cleanup_module(void){
+  unsigned long i;
+  slot_elem* elem;
+  if ( major_number <= 0 ){
+  		printk(KERN_INFO "%s: No device registered!\n", MODNAME);
+  		return;
+  }
+  //only the slots still holding messages are left
+  xa_for_each( &mailslots, i, elem ){
+    xa_erase( &mailslots, i );
+    slot_destroy(elem);
+  }
+  xa_destroy( &mailslots );
+  debugfs_remove_recursive(lms_debugfs);
+  lms_core_exit();
+
+  __unregister_chrdev(major_number, 0, max_minors, DEVICE_NAME);
+  printk(KERN_INFO "%s:Device unregistered!\n", MODNAME);
+  return;
+}
@@ -0,0 +1,466 @@
+#ifndef LMS_STUB_H
+#define LMS_STUB_H
+
+/*
+user space stand ins for the kernel primitives used by lms_core.c, so that the engine can be
+built and measured as a plain library (see lms_bench.c). locks and wait queues are pthread
+objects, atomics are the gcc builtins, the slab caches are malloc and the per cpu counters
+are shared relaxed atomics. rcu readers hold a global rwlock that synchronize_rcu takes for
+writing. tracepoints and debug messages compile away
+*/
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <linux/types.h>
+
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+
+#define __user
+#define __percpu
+#define __rcu
+#define ____cacheline_aligned_in_smp __attribute__((aligned(64)))
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define PAGE_SIZE 4096UL
+#define GFP_KERNEL 0
+#define SLAB_HWCACHE_ALIGN 0
+#ifndef U32_MAX
+#define U32_MAX UINT32_MAX
+#endif
+#define READ 0
+#define WRITE 1
+
+//messages
+#define KERN_INFO ""
+#define printk(...) fprintf(stderr, __VA_ARGS__)
+#define pr_debug(...) do {} while (0)
+#define pr_debug_ratelimited(...) do {} while (0)
+#define module_param(name, type, perm)
+#define MODULE_PARM_DESC(name, desc)
+
+//tracepoints
+#define trace_lms_enqueue_enabled() 0
+#define trace_lms_dequeue_enabled() 0
+#define trace_lms_block_enabled() 0
+#define trace_lms_wake_enabled() 0
+#define trace_lms_reject_enabled() 0
+#define trace_lms_enqueue(...) do {} while (0)
+#define trace_lms_dequeue(...) do {} while (0)
+#define trace_lms_block(...) do {} while (0)
+#define trace_lms_wake(...) do {} while (0)
+#define trace_lms_reject(...) do {} while (0)
+
+//helpers
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(type, a, b) min((type) (a), (type) (b))
+#define swap(a, b) do { __typeof__(a) __tmp = (a); (a) = (b); (b) = __tmp; } while (0)
+#define u64_to_user_ptr(x) ((void*) (uintptr_t) (x))
+
+static inline unsigned long __fls(unsigned long word){ return 63 - __builtin_clzl(word); }
+static inline unsigned long __ffs(unsigned long word){ return __builtin_ctzl(word); }
+static inline int fls64(u64 x){ return x == 0 ? 0 : 64 - __builtin_clzll(x); }
+static inline void __set_bit(int nr, unsigned long* addr){ *addr |= 1UL << nr; }
+static inline void __clear_bit(int nr, unsigned long* addr){ *addr &= ~(1UL << nr); }
+static inline unsigned long roundup_pow_of_two(unsigned long n){ return n <= 1 ? 1 : 1UL << (64 - __builtin_clzl(n - 1)); }
+static inline unsigned long rounddown_pow_of_two(unsigned long n){ return 1UL << (63 - __builtin_clzl(n)); }
+
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_USEC 1000L
+static inline u64 ktime_get_ns(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//memory model
+#define READ_ONCE(x) (*(volatile __typeof__(x)*) &(x))
+#define WRITE_ONCE(x, v) (*(volatile __typeof__(x)*) &(x) = (v))
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+//a busy poll never has to give the cpu back
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#define need_resched() 0
+
+typedef struct { int counter; } atomic_t;
+typedef struct { long counter; } atomic_long_t;
+
+#define atomic_read(v) __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_read_acquire(v) __atomic_load_n(&(v)->counter, __ATOMIC_ACQUIRE)
+#define atomic_set(v, i) __atomic_store_n(&(v)->counter, i, __ATOMIC_RELAXED)
+#define atomic_set_release(v, i) __atomic_store_n(&(v)->counter, i, __ATOMIC_RELEASE)
+#define atomic_add(i, v) ((void) __atomic_fetch_add(&(v)->counter, i, __ATOMIC_RELAXED))
+#define atomic_inc(v) atomic_add(1, v)
+#define atomic_dec(v) atomic_add(-1, v)
+#define atomic_sub(i, v) atomic_add(-(i), v)
+#define atomic_try_cmpxchg(v, old, new) __atomic_compare_exchange_n(&(v)->counter, old, new, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)
+#define cmpxchg(p, old, new) ({ __typeof__(*(p)) __old = (old); __atomic_compare_exchange_n(p, &__old, new, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED); __old; })
+static inline int atomic_cmpxchg(atomic_t* v, int old, int new){
+  __atomic_compare_exchange_n(&v->counter, &old, new, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+  return old;
+}
+#define atomic_long_read(v) __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_long_inc(v) ((void) __atomic_fetch_add(&(v)->counter, 1, __ATOMIC_RELAXED))
+#define atomic_long_sub(i, v) ((void) __atomic_fetch_sub(&(v)->counter, i, __ATOMIC_RELAXED))
+#define atomic_long_add_return(i, v) __atomic_add_fetch(&(v)->counter, i, __ATOMIC_SEQ_CST)
+
+//per cpu counters, a single copy
+#define alloc_percpu(type) ((type*) calloc(1, sizeof(type)))
+#define free_percpu(p) free(p)
+#define this_cpu_add(x, v) ((void) __atomic_fetch_add(&(x), v, __ATOMIC_RELAXED))
+#define this_cpu_inc(x) this_cpu_add(x, 1)
+
+//rcu
+extern pthread_rwlock_t lms_rcu_lock;
+#define rcu_read_lock() pthread_rwlock_rdlock(&lms_rcu_lock)
+#define rcu_read_unlock() pthread_rwlock_unlock(&lms_rcu_lock)
+#define rcu_dereference(p) smp_load_acquire(&(p))
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_access_pointer(p) READ_ONCE(p)
+#define rcu_assign_pointer(p, v) smp_store_release(&(p), v)
+#define RCU_INIT_POINTER(p, v) ((p) = (v))
+#define lockdep_is_held(l) 1
+static inline void synchronize_rcu(void){
+  pthread_rwlock_wrlock(&lms_rcu_lock);
+  pthread_rwlock_unlock(&lms_rcu_lock);
+}
+
+//memory
+struct kmem_cache { size_t size; };
+static inline struct kmem_cache* kmem_cache_create(const char* name, size_t size, size_t align, unsigned long flags, void* ctor){
+  struct kmem_cache* c = malloc(sizeof(*c));
+  if ( c != NULL ) c->size = size;
+  return c;
+}
+#define kmem_cache_destroy(c) free(c)
+#define kmem_cache_alloc(c, gfp) malloc((c)->size)
+#define kmem_cache_free(c, p) free(p)
+#define kmalloc(size, gfp) malloc(size)
+#define kmalloc_array(n, size, gfp) calloc(n, size)
+#define kfree(p) free(p)
+#define kvmalloc(size, gfp) malloc(size)
+#define kvzalloc(size, gfp) calloc(1, size)
+#define kvfree(p) free(p)
+static inline char* kasprintf(int gfp, const char* fmt, ...){
+  char* s;
+  int len;
+  va_list ap;
+  va_start(ap, fmt);
+  len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  s = malloc(len + 1);
+  if ( s == NULL ) return NULL;
+  va_start(ap, fmt);
+  vsnprintf(s, len + 1, fmt, ap);
+  va_end(ap);
+  return s;
+}
+#define vmalloc_user(size) calloc(1, size)
+#define vfree(p) free(p)
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+
+struct page { char data[PAGE_SIZE]; };
+#define alloc_page(gfp) ((struct page*) malloc(sizeof(struct page)))
+#define __free_page(p) free(p)
+#define page_address(p) ((void*) (p)->data)
+
+//a single node
+#define NUMA_NO_NODE (-1)
+#define MAX_NUMNODES 1
+#define numa_node_id() 0
+#define node_online(node) ((node) == 0)
+#define page_to_nid(p) ((void)(p), 0)
+#define virt_to_page(addr) ((struct page*) (addr))
+#define alloc_pages_node(node, gfp, order) alloc_page(gfp)
+#define kmem_cache_alloc_node(c, gfp, node) kmem_cache_alloc(c, gfp)
+#define kvmalloc_node(size, gfp, node) kvmalloc(size, gfp)
+#define kmalloc_array_node(n, size, gfp, node) kmalloc_array(n, size, gfp)
+
+//locks, a task never sleeps holding a spinlock so a mutex stands in for it
+typedef pthread_mutex_t spinlock_t;
+#define spin_lock_init(l) pthread_mutex_init(l, NULL)
+#define spin_lock(l) pthread_mutex_lock(l)
+#define spin_lock_nested(l, subclass) pthread_mutex_lock(l)
+#define spin_trylock(l) (pthread_mutex_trylock(l) == 0)
+#define spin_unlock(l) pthread_mutex_unlock(l)
+
+struct mutex { pthread_mutex_t m; };
+#define mutex_init(l) pthread_mutex_init(&(l)->m, NULL)
+#define mutex_lock(l) pthread_mutex_lock(&(l)->m)
+#define mutex_lock_interruptible(l) pthread_mutex_lock(&(l)->m)
+#define mutex_trylock(l) (pthread_mutex_trylock(&(l)->m) == 0)
+#define mutex_unlock(l) pthread_mutex_unlock(&(l)->m)
+
+//wait queues: the condition is checked under the queue lock, the sleepers count pairs with
+//the full barrier of wq_has_sleeper so that a waker skipping the wakeup is always seen.
+//there are no signals, a wait ends only when its condition holds
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int sleepers;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t* wq){
+  pthread_mutex_init(&wq->lock, NULL);
+  pthread_cond_init(&wq->cond, NULL);
+  wq->sleepers = 0;
+}
+
+static inline int wq_has_sleeper(wait_queue_head_t* wq){
+  smp_mb();
+  return __atomic_load_n(&wq->sleepers, __ATOMIC_RELAXED) > 0;
+}
+
+//exclusive wakeup, a single waiter
+static inline void wake_up_interruptible_poll(wait_queue_head_t* wq, int mask){
+  pthread_mutex_lock(&wq->lock);
+  pthread_cond_signal(&wq->cond);
+  pthread_mutex_unlock(&wq->lock);
+}
+
+static inline void wake_up_interruptible_all(wait_queue_head_t* wq){
+  pthread_mutex_lock(&wq->lock);
+  pthread_cond_broadcast(&wq->cond);
+  pthread_mutex_unlock(&wq->lock);
+}
+
+//the timeout is in jiffies, milliseconds here. like the kernel macro it returns 0 when the time
+//is over and the condition still false, otherwise the jiffies left, at least 1
+#define HZ 1000
+#define MAX_SCHEDULE_TIMEOUT LONG_MAX
+#define msecs_to_jiffies(ms) ((long) (ms))
+
+static inline long jiffies_left(const struct timespec* end){
+  struct timespec now;
+  long left;
+  clock_gettime(CLOCK_REALTIME, &now);
+  left = (end->tv_sec - now.tv_sec) * 1000 + (end->tv_nsec - now.tv_nsec) / 1000000;
+  return left > 0 ? left : 0;
+}
+
+#define wait_event_interruptible_timeout(wq, condition, timeout) ({             \
+  long __left = (timeout);                                                     \
+  struct timespec __end;                                                       \
+  clock_gettime(CLOCK_REALTIME, &__end);                                       \
+  __end.tv_sec += __left / 1000;                                               \
+  __end.tv_nsec += (__left % 1000) * 1000000;                                  \
+  if ( __end.tv_nsec >= 1000000000 ){                                          \
+    __end.tv_sec++;                                                            \
+    __end.tv_nsec -= 1000000000;                                               \
+  }                                                                            \
+  pthread_mutex_lock(&(wq).lock);                                              \
+  __atomic_add_fetch(&(wq).sleepers, 1, __ATOMIC_SEQ_CST);                     \
+  while ( !(condition) ){                                                      \
+    if ( __left == MAX_SCHEDULE_TIMEOUT ) pthread_cond_wait(&(wq).cond, &(wq).lock);  \
+    else if ( pthread_cond_timedwait(&(wq).cond, &(wq).lock, &__end) == ETIMEDOUT ) break;  \
+  }                                                                            \
+  if ( !(condition) ) __left = 0;                                              \
+  else if ( __left != MAX_SCHEDULE_TIMEOUT ) __left = max(jiffies_left(&__end), 1L);  \
+  __atomic_sub_fetch(&(wq).sleepers, 1, __ATOMIC_SEQ_CST);                     \
+  pthread_mutex_unlock(&(wq).lock);                                            \
+  __left;                                                                      \
+})
+//the waker decides between one and every waiter
+#define wait_event_interruptible_exclusive_timeout wait_event_interruptible_timeout
+
+//files and user copies, a session is driven from the same address space
+struct path { int fd; };
+
+struct file {
+  unsigned int f_flags;
+  void* private_data;
+  struct path f_path;   //a file opened by filp_open, on its descriptor
+};
+
+#ifndef O_LARGEFILE
+#define O_LARGEFILE 0   //off_t is 64 bit already
+#endif
+#define ERR_PTR(err) ((void*) (long) (err))
+#define PTR_ERR(p) ((long) (p))
+#define IS_ERR(p) ((unsigned long) (p) >= (unsigned long) -4095)
+
+static inline struct file* filp_open(const char* path, int flags, int mode){
+  struct file* f = calloc(1, sizeof(*f));
+  if ( f == NULL ) return ERR_PTR(-ENOMEM);
+  f->f_path.fd = open(path, flags, mode);
+  if ( f->f_path.fd < 0 ){
+    free(f);
+    return ERR_PTR(-errno);
+  }
+  return f;
+}
+
+static inline int filp_close(struct file* f, void* id){
+  int ret = close(f->f_path.fd);
+  free(f);
+  return ret;
+}
+#define vfs_llseek(f, off, whence) lseek((f)->f_path.fd, off, whence)
+#define vfs_truncate(path, len) ftruncate((path)->fd, len)
+#define vfs_fsync(f, datasync) fsync((f)->f_path.fd)
+
+static inline ssize_t kernel_read(struct file* f, void* buf, size_t count, loff_t* pos){
+  ssize_t ret = pread(f->f_path.fd, buf, count, *pos);
+  if ( ret > 0 ) *pos += ret;
+  return ret;
+}
+
+static inline ssize_t kernel_write(struct file* f, const void* buf, size_t count, loff_t* pos){
+  ssize_t ret = pwrite(f->f_path.fd, buf, count, *pos);
+  if ( ret > 0 ) *pos += ret;
+  return ret;
+}
+
+#define copy_from_user(to, from, n) (memcpy(to, from, n), 0)
+#define copy_to_user(to, from, n) (memcpy(to, from, n), 0)
+#define put_user(x, ptr) (*(ptr) = (x), 0)
+
+//iov_iter over an array of iovec
+struct iov_iter {
+  const struct iovec* iov;
+  unsigned long nr_segs;
+  size_t iov_offset;
+  size_t count;
+};
+
+static inline void iov_iter_init(struct iov_iter* i, int direction, const struct iovec* iov, unsigned long nr_segs, size_t count){
+  i->iov = iov;
+  i->nr_segs = nr_segs;
+  i->iov_offset = 0;
+  i->count = count;
+}
+
+static inline int import_single_range(int rw, void* buf, size_t len, struct iovec* iov, struct iov_iter* i){
+  iov->iov_base = buf;
+  iov->iov_len = len;
+  iov_iter_init(i, rw, iov, 1, len);
+  return 0;
+}
+#define import_user_range(rw, buf, len, iov, i) import_single_range(rw, buf, len, iov, i)
+
+static inline size_t iov_iter_count(const struct iov_iter* i){ return i->count; }
+
+static inline size_t iov_iter_single_seg_count(const struct iov_iter* i){
+  if ( i->nr_segs == 0 ) return 0;
+  return min(i->count, i->iov->iov_len - i->iov_offset);
+}
+
+static inline void iov_iter_advance(struct iov_iter* i, size_t bytes){
+  size_t step;
+  bytes = min(bytes, i->count);
+  i->count -= bytes;
+  while ( bytes > 0 ){
+    step = min(bytes, i->iov->iov_len - i->iov_offset);
+    i->iov_offset += step;
+    bytes -= step;
+    if ( i->iov_offset == i->iov->iov_len ){
+      i->iov++;
+      i->nr_segs--;
+      i->iov_offset = 0;
+    }
+  }
+}
+
+static inline size_t copy_iter(void* buf, size_t bytes, struct iov_iter* i, int to_iter){
+  size_t done = 0, step;
+  bytes = min(bytes, i->count);
+  while ( done < bytes ){
+    step = min(bytes - done, i->iov->iov_len - i->iov_offset);
+    if ( to_iter ) memcpy((char*) i->iov->iov_base + i->iov_offset, (char*) buf + done, step);
+    else memcpy((char*) buf + done, (char*) i->iov->iov_base + i->iov_offset, step);
+    iov_iter_advance(i, step);
+    done += step;
+  }
+  return done;
+}
+
+#define copy_from_iter(addr, bytes, i) copy_iter(addr, bytes, i, 0)
+#define copy_to_iter(addr, bytes, i) copy_iter((void*) (addr), bytes, i, 1)
+#define copy_page_from_iter(p, offset, bytes, i) copy_iter((p)->data + (offset), bytes, i, 0)
+#define copy_page_to_iter(p, offset, bytes, i) copy_iter((p)->data + (offset), bytes, i, 1)
+
+//a kernel buffer is just another address
+#define kvec iovec
+#define iov_iter_kvec(i, direction, v, nr_segs, count) iov_iter_init(i, direction, v, nr_segs, count)
+
+#define container_of(ptr, type, member) ((type*) ((char*) (ptr) - offsetof(type, member)))
+
+//delayed work: every schedule starts a detached thread that sleeps the delay and runs the
+//function unless cancelled meanwhile, cancel_delayed_work_sync waits for all of them
+struct work_struct {
+  void (*func)(struct work_struct*);
+};
+
+struct delayed_work {
+  struct work_struct work;
+  long delay;
+  int pending;
+  int running;
+  int cancelled;
+};
+
+#define INIT_DELAYED_WORK(dw, fn) do { (dw)->work.func = (fn); (dw)->pending = 0; (dw)->running = 0; (dw)->cancelled = 0; } while (0)
+#define to_delayed_work(w) container_of(w, struct delayed_work, work)
+
+static inline void* delayed_work_thread(void* arg){
+  struct delayed_work* dw = arg;
+  struct timespec ts = { dw->delay / 1000, (dw->delay % 1000) * 1000000 };
+  nanosleep(&ts, NULL);
+  //cleared first, the function may schedule the work again
+  __atomic_store_n(&dw->pending, 0, __ATOMIC_SEQ_CST);
+  if ( !__atomic_load_n(&dw->cancelled, __ATOMIC_SEQ_CST) ) dw->work.func(&dw->work);
+  __atomic_sub_fetch(&dw->running, 1, __ATOMIC_SEQ_CST);
+  return NULL;
+}
+
+static inline int schedule_delayed_work(struct delayed_work* dw, long delay){
+  pthread_t th;
+  if ( __atomic_exchange_n(&dw->pending, 1, __ATOMIC_SEQ_CST) ) return 0;
+  dw->delay = delay;
+  __atomic_add_fetch(&dw->running, 1, __ATOMIC_SEQ_CST);
+  if ( pthread_create(&th, NULL, delayed_work_thread, dw) != 0 ){
+    __atomic_sub_fetch(&dw->running, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&dw->pending, 0, __ATOMIC_SEQ_CST);
+    return 0;
+  }
+  pthread_detach(th);
+  return 1;
+}
+
+static inline int cancel_delayed_work_sync(struct delayed_work* dw){
+  struct timespec ts = { 0, 100000 };
+  __atomic_store_n(&dw->cancelled, 1, __ATOMIC_SEQ_CST);
+  while ( __atomic_load_n(&dw->running, __ATOMIC_SEQ_CST) > 0 ) nanosleep(&ts, NULL);
+  __atomic_store_n(&dw->pending, 0, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&dw->cancelled, 0, __ATOMIC_SEQ_CST);
+  return 0;
+}
+
+//work run by a kworker and waited for: the calling thread runs it
+#define system_unbound_wq NULL
+#define INIT_WORK_ONSTACK(w, fn) ((w)->func = (fn))
+static inline int queue_work(void* wq, struct work_struct* w){
+  (void) wq;
+  w->func(w);
+  return 1;
+}
+#define flush_work(w) ((void) (w))
+#define destroy_work_on_stack(w) ((void) (w))
+
+#endif
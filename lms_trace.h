@@ -0,0 +1,113 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mailslot
+
+#if !defined(_LMS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LMS_TRACE_H
+
+/*
+tracepoints of the LinuxMailSlots module, every event carries the minor of the slot, the size
+of the message (or the free bytes waited for) and the depth, the bytes queued in the slot.
+enable them with perf or through /sys/kernel/tracing/events/mailslot
+*/
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(lms_msg_class,
+
+  TP_PROTO(int minor, size_t size, int depth),
+
+  TP_ARGS(minor, size, depth),
+
+  TP_STRUCT__entry(
+    __field(int, minor)
+    __field(size_t, size)
+    __field(int, depth)
+  ),
+
+  TP_fast_assign(
+    __entry->minor = minor;
+    __entry->size = size;
+    __entry->depth = depth;
+  ),
+
+  TP_printk("minor=%d size=%zu depth=%d", __entry->minor, __entry->size, __entry->depth)
+);
+
+//a message was queued, depth includes it
+DEFINE_EVENT(lms_msg_class, lms_enqueue,
+  TP_PROTO(int minor, size_t size, int depth),
+  TP_ARGS(minor, size, depth)
+);
+
+//a message was taken, depth does not include it anymore
+DEFINE_EVENT(lms_msg_class, lms_dequeue,
+  TP_PROTO(int minor, size_t size, int depth),
+  TP_ARGS(minor, size, depth)
+);
+
+DECLARE_EVENT_CLASS(lms_wait_class,
+
+  TP_PROTO(int minor, size_t size, int depth, int writer),
+
+  TP_ARGS(minor, size, depth, writer),
+
+  TP_STRUCT__entry(
+    __field(int, minor)
+    __field(size_t, size)
+    __field(int, depth)
+    __field(int, writer)
+  ),
+
+  TP_fast_assign(
+    __entry->minor = minor;
+    __entry->size = size;
+    __entry->depth = depth;
+    __entry->writer = writer;
+  ),
+
+  TP_printk("minor=%d %s size=%zu depth=%d", __entry->minor, __entry->writer ? "writer" : "reader", __entry->size, __entry->depth)
+);
+
+//a task goes to sleep in a wait queue of the slot, size is the free space a writer needs
+DEFINE_EVENT(lms_wait_class, lms_block,
+  TP_PROTO(int minor, size_t size, int depth, int writer),
+  TP_ARGS(minor, size, depth, writer)
+);
+
+//the task woke up, because of its condition or of a signal
+DEFINE_EVENT(lms_wait_class, lms_wake,
+  TP_PROTO(int minor, size_t size, int depth, int writer),
+  TP_ARGS(minor, size, depth, writer)
+);
+
+//a read or a write failed, err is the value returned to user space
+TRACE_EVENT(lms_reject,
+
+  TP_PROTO(int minor, size_t size, int depth, int err),
+
+  TP_ARGS(minor, size, depth, err),
+
+  TP_STRUCT__entry(
+    __field(int, minor)
+    __field(size_t, size)
+    __field(int, depth)
+    __field(int, err)
+  ),
+
+  TP_fast_assign(
+    __entry->minor = minor;
+    __entry->size = size;
+    __entry->depth = depth;
+    __entry->err = err;
+  ),
+
+  TP_printk("minor=%d size=%zu depth=%d err=%d", __entry->minor, __entry->size, __entry->depth, __entry->err)
+);
+
+#endif /* _LMS_TRACE_H */
+
+//this part must be outside the protection
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE lms_trace
+#include <trace/define_trace.h>
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -6,7 +7,12 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "LinuxMailSlots.h"
 
 
 
@@ -17,6 +23,20 @@
 
 void do_work_child(char* path, int len, int mode);
 static char *rand_string(size_t len);
+void test_ring_mmap(const char* path, int len);
+void contention_test(const char* path, int readers, int messages, int len);
+void throughput_test(const char* path, int procs, int messages, int len);
+void test_priority(const char* path);
+void test_peek(const char* path);
+void test_forward(const char* src_path, const char* dst_path);
+void test_overflow(const char* path);
+void test_timeout(const char* path, int ms);
+void test_broadcast(const char* path, int readers);
+void test_coalescing(const char* path, int records);
+void test_coalescing_full(const char* path);
+void test_busy_poll(const char* path, int us);
+void test_stress(const char* path, int procs, int messages);
+void test_spill(const char* path, int messages);
 
 void open_close(char* path){
   int fd = open(path , O_RDWR);
@@ -36,9 +56,51 @@ void test_ioctl(char* path,int param , int value){
   if (fd ) {
 
     int rc = ioctl(fd, param , value);//GET_SLOT_SIZE 111
+    printf("ioctl %d on %s returned %d\n", param, path, rc);
+    struct lms_slot_info info;
+    if ( ioctl(fd, GET_SLOT_INFO, &info) == 0 )
+      printf("slot %u: storage %u, budget %u, free %u, message size %u (max %u), %s, node %d\n", info.minor, info.storage,
+             info.budget, info.free, info.msg_size, info.max_msg_size, info.blocking ? "blocking" : "non blocking", info.node);
+    close(fd);
   }
 }
 
+//produce one message through the shared ring and consume it with a plain read
+void test_ring_mmap(const char* path, int len){
+  int fd = open(path , O_RDWR);
+  int rd = open(path , O_RDWR);
+  long page = sysconf(_SC_PAGESIZE);
+  if ( fd < 0 || rd < 0 ) return;
+  if ( ioctl(fd, CHANGE_STORAGE_MODE, STORAGE_RING) != 0 || ioctl(fd, RING_CLAIM, RING_PRODUCER) != 0 ){
+    printf("cannot switch %s to a user space ring producer\n", path);
+    return;
+  }
+  struct lms_ring_ctrl* ctrl = mmap(NULL, page, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if ( ctrl == MAP_FAILED ) return;
+  char* data = mmap(NULL, page + ctrl->size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  munmap(ctrl, page);
+  if ( data == MAP_FAILED ) return;
+  ctrl = (struct lms_ring_ctrl*) data;
+  data += page;
+
+  char* msg = rand_string(len);
+  __u32 tail = ctrl->tail;
+  while ( ctrl->size - (tail - __atomic_load_n(&ctrl->head, __ATOMIC_ACQUIRE)) < LMS_RING_RECORD_SIZE(len) )
+    ioctl(fd, RING_WAIT_WRITABLE, LMS_RING_RECORD_SIZE(len));
+  for (int i = 0; i < len; i++) data[(tail + LMS_RING_HDR_SIZE + i) & (ctrl->size - 1)] = msg[i];
+  *(__u32*)(data + (tail & (ctrl->size - 1))) = len;
+  __atomic_store_n(&ctrl->tail, tail + LMS_RING_RECORD_SIZE(len), __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if ( ctrl->readers_waiting ) ioctl(fd, RING_NOTIFY, 0);
+
+  char* buff = malloc(len);
+  int ret = read(rd, buff, len);
+  printf("ring mmap: produced %d bytes, read %d bytes, %s\n", len, ret, ret == len && memcmp(buff, msg, len) == 0 ? "match" : "MISMATCH");
+  munmap(ctrl, page + ctrl->size);
+  close(rd);
+  close(fd);
+}
+
 void create_n_process(int n , int len , char* file){
   int pids[n];
   int i;
@@ -107,8 +169,431 @@ void do_work_child(char* path, int len , int mode ){
 
 
 
+static double now_sec(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+//readers block on an empty mailslot, then a single writer feeds them: every message
+//has to wake exactly one of them, a 1 byte message tells a reader to quit
+void contention_test(const char* path, int readers, int messages, int len){
+  int i, status;
+  char* buff = malloc(len);
+  for (i = 0; i < readers; i++) {
+    if (fork() == 0) {
+      int fd = open(path, O_RDWR), got = 0, ret;
+      while ( (ret = read(fd, buff, len)) != 1 ) if ( ret > 0 ) got++;
+      DEBUG printf("reader %d got %d messages\n", getpid(), got);
+      close(fd);
+      exit(0);
+    }
+  }
+  sleep(1); //let every reader block
+  int fd = open(path, O_RDWR);
+  memset(buff, 'x', len);
+  double start = now_sec();
+  for (i = 0; i < messages; i++) while ( write(fd, buff, len) != len ) ;
+  for (i = 0; i < readers; i++) while ( write(fd, buff, 1) != 1 ) ;
+  while ( wait(&status) > 0 ) ;
+  double elapsed = now_sec() - start;
+  printf("contention: %d blocked readers, %d messages of %d bytes in %.3f s, %.0f msg/s, %.2f us/msg\n",
+         readers, messages, len, elapsed, messages / elapsed, elapsed * 1e6 / messages);
+  close(fd);
+  free(buff);
+}
+
+
+//procs writers and procs readers hammer the same mailslot, once for each storage mode
+static double throughput_run(const char* path, int storage, int procs, int messages, int len){
+  int i, status, fd = open(path, O_RDWR);
+  char* buff = malloc(len);
+  if ( fd < 0 || ioctl(fd, CHANGE_STORAGE_MODE, storage) != 0 ){
+    printf("throughput: cannot switch %s to storage %d, is it empty?\n", path, storage);
+    return 0;
+  }
+  for (i = 0; i < procs; i++) {
+    if (fork() == 0) {
+      int rd = open(path, O_RDWR);
+      while ( read(rd, buff, len) != 1 ) ;
+      exit(0);
+    }
+  }
+  memset(buff, 'x', len);
+  double start = now_sec();
+  for (i = 0; i < procs; i++) {
+    if (fork() == 0) {
+      int wr = open(path, O_RDWR);
+      for (int j = 0; j < messages / procs; j++) while ( write(wr, buff, len) != len ) ;
+      exit(0);
+    }
+  }
+  //the writers first, then a quit message for every reader
+  for (i = 0; i < procs; i++) wait(&status);
+  for (i = 0; i < procs; i++) while ( write(fd, buff, 1) != 1 ) ;
+  while ( wait(&status) > 0 ) ;
+  double elapsed = now_sec() - start;
+  ioctl(fd, CHANGE_STORAGE_MODE, STORAGE_LIST);
+  close(fd);
+  free(buff);
+  return (messages / procs) * procs / elapsed;
+}
+
+
+void throughput_test(const char* path, int procs, int messages, int len){
+  double locked = throughput_run(path, STORAGE_LIST, procs, messages, len);
+  double lockfree = throughput_run(path, STORAGE_LOCKFREE, procs, messages, len);
+  printf("throughput: %d writers %d readers, %d messages of %d bytes\n", procs, procs, messages, len);
+  printf("  spinlock  %12.0f msg/s\n  lock free %12.0f msg/s (x%.2f)\n", locked, lockfree, locked > 0 ? lockfree / locked : 0);
+}
+
+
+//an urgent message written after a burst of bulk ones has to be read first
+void test_priority(const char* path){
+  int bulk = open(path, O_RDWR), urgent = open(path, O_RDWR);
+  char buff[64];
+  if ( bulk < 0 || urgent < 0 || ioctl(urgent, CHANGE_WRITE_PRIORITY, LMS_PRIO_LEVELS - 1) != 0 ){
+    printf("priority: cannot set up %s\n", path);
+    return;
+  }
+  for (int i = 0; i < 8; i++) write(bulk, "bulk", 4);
+  write(urgent, "urgent", 6);
+  int ret = read(bulk, buff, sizeof(buff));
+  printf("priority: first message read is %.*s, %s\n", ret > 0 ? ret : 0, buff, ret == 6 && memcmp(buff, "urgent", 6) == 0 ? "ok" : "WRONG ORDER");
+  for (int i = 0; i < 8; i++) read(bulk, buff, sizeof(buff));
+  close(urgent);
+  close(bulk);
+}
+
+//size the buffer of every read with PEEK_MESSAGE, then look at a message twice before taking it
+void test_peek(const char* path){
+  int fd = open(path, O_RDWR);
+  struct lms_msg_info info;
+  char first[32];
+  if ( fd < 0 ) return;
+  write(fd, "short", 5);
+  write(fd, "a longer message", 16);
+  for (int i = 0; i < 2; i++){
+    int size = ioctl(fd, PEEK_MESSAGE, &info);
+    if ( size <= 0 ) break;
+    char* buff = malloc(size);
+    int ret = read(fd, buff, size);
+    printf("peek: next message of %d bytes (prio %u, %u bytes queued), read %d bytes %.*s\n", size, info.prio, info.depth, ret, ret > 0 ? ret : 0, buff);
+    free(buff);
+  }
+  write(fd, "peeked", 6);
+  ioctl(fd, CHANGE_READ_FLAGS, LMS_READ_PEEK);
+  int a = read(fd, first, sizeof(first));
+  int b = read(fd, first, sizeof(first));
+  ioctl(fd, CHANGE_READ_FLAGS, 0);
+  int c = read(fd, first, sizeof(first));
+  printf("peek: read %d, %d with LMS_READ_PEEK and %d without, %s\n", a, b, c, a == 6 && b == 6 && c == 6 && ioctl(fd, PEEK_MESSAGE, 0) < 0 ? "ok" : "WRONG");
+  close(fd);
+}
+
+//relay messages from src to dst in the kernel, first with FORWARD_MESSAGES then through a pipe
+void test_forward(const char* src_path, const char* dst_path){
+  int src = open(src_path, O_RDWR), dst = open(dst_path, O_RDWR), p[2];
+  struct lms_forward req = { .fd = dst, .max_msgs = 2 };
+  char buff[64];
+  if ( src < 0 || dst < 0 || pipe(p) != 0 ) return;
+  write(src, "one", 3);
+  write(src, "two", 3);
+  write(src, "three", 5);
+  int moved = ioctl(src, FORWARD_MESSAGES, &req);
+  int a = read(dst, buff, sizeof(buff));
+  int b = read(dst, buff, sizeof(buff));
+  printf("forward: moved %d messages, read %d and %d bytes from %s\n", moved, a, b, dst_path);
+  ssize_t in = splice(src, NULL, p[1], NULL, sizeof(buff), 0);
+  ssize_t out = splice(p[0], NULL, dst, NULL, in > 0 ? in : 1, 0);
+  int c = read(dst, buff, sizeof(buff));
+  printf("splice: %zd bytes into the pipe, %zd out of it, read %.*s from %s\n", in, out, c > 0 ? c : 0, buff, dst_path);
+  //two queued messages, each splice takes one of them and nothing else
+  write(src, "four", 4);
+  write(src, "five!", 5);
+  ssize_t in1 = splice(src, NULL, p[1], NULL, sizeof(buff), 0);
+  ssize_t in2 = splice(src, NULL, p[1], NULL, sizeof(buff), 0);
+  out = splice(p[0], NULL, dst, NULL, in1 + in2 > 0 ? in1 + in2 : 1, 0);
+  int d = read(dst, buff, sizeof(buff));
+  int e = read(dst, buff + 32, sizeof(buff) - 32);
+  printf("splice: %zd and %zd bytes into the pipe, %zd out of it, %s\n", in1, in2, out,
+         in1 == 4 && in2 == 5 && out == 9 && d == 4 && e == 5 && memcmp(buff, "four", 4) == 0 && memcmp(buff + 32, "five!", 5) == 0 ? "ok" : "WRONG");
+  close(p[0]);
+  close(p[1]);
+  close(src);
+  close(dst);
+}
+
+//overfill a slot with the two drop policies, then let what is left expire
+void test_overflow(const char* path){
+  int fd = open(path, O_RDWR | O_NONBLOCK);
+  struct lms_slot_info info;
+  char buff[512];
+  if ( fd < 0 || ioctl(fd, GET_SLOT_INFO, &info) != 0 ) return;
+  ioctl(fd, CHANGE_MESSAGE_SIZE, info.max_msg_size);
+  ioctl(fd, CHANGE_SLOT_BUDGET, info.max_msg_size);
+  memset(buff, 0, sizeof(buff));
+  ioctl(fd, CHANGE_OVERFLOW_POLICY, LMS_OVERFLOW_DROP_NEWEST);
+  for (int i = 0; i < 4; i++){
+    buff[0] = '0' + i;
+    write(fd, buff, info.max_msg_size / 2);
+  }
+  ioctl(fd, CHANGE_OVERFLOW_POLICY, LMS_OVERFLOW_DROP_OLDEST);
+  buff[0] = '4';
+  write(fd, buff, info.max_msg_size / 2);
+  int a = read(fd, buff, sizeof(buff));
+  char first = buff[0];
+  ioctl(fd, CHANGE_SLOT_TTL, 10);
+  usleep(20000);
+  int b = read(fd, buff, sizeof(buff));
+  printf("overflow: first message %c (%d bytes), read %d after the ttl, %s\n", first, a, b, first == '1' && b < 0 ? "ok" : "WRONG");
+  ioctl(fd, CHANGE_SLOT_TTL, 0);
+  ioctl(fd, CHANGE_OVERFLOW_POLICY, LMS_OVERFLOW_BLOCK);
+  close(fd);
+}
+
+//a blocking read of an empty slot gives up after ms with ETIMEDOUT
+void test_timeout(const char* path, int ms){
+  int fd = open(path, O_RDWR);
+  char buff[64];
+  struct timespec start, end;
+  if ( fd < 0 ) return;
+  ioctl(fd, CHANGE_BLOCKING_MODE, 0);
+  while ( read(fd, buff, sizeof(buff)) > 0 );
+  ioctl(fd, CHANGE_BLOCKING_MODE, 1);
+  ioctl(fd, CHANGE_READ_TIMEOUT, ms);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int ret = read(fd, buff, sizeof(buff));
+  int err = errno;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long waited = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+  printf("timeout: read returned %d (%s) after %ld ms, %s\n", ret, strerror(err), waited, ret < 0 && err == ETIMEDOUT && waited >= ms ? "ok" : "WRONG");
+  close(fd);
+}
+
+//every subscriber reads every message, written once
+void test_broadcast(const char* path, int readers){
+  int w = open(path, O_WRONLY), fds[readers], got = 0;
+  char buff[64];
+  if ( w < 0 || ioctl(w, CHANGE_STORAGE_MODE, STORAGE_BROADCAST) != 0 ) return;
+  for (int i = 0; i < readers; i++) fds[i] = open(path, O_RDONLY | O_NONBLOCK);
+  write(w, "one", 3);
+  write(w, "two", 3);
+  for (int i = 0; i < readers; i++){
+    while ( read(fds[i], buff, sizeof(buff)) > 0 ) got++;
+    close(fds[i]);
+  }
+  printf("broadcast: %d readers got %d messages, %s\n", readers, got, got == 2 * readers ? "ok" : "WRONG");
+  ioctl(w, CHANGE_STORAGE_MODE, STORAGE_LIST);
+  close(w);
+}
+
+//small writes come out as one batch, walked through its record index. the default 20 records
+//fit a batch of the default max_msg_size
+void test_coalescing(const char* path, int records){
+  int w = open(path, O_WRONLY), r = open(path, O_RDONLY | O_NONBLOCK), got = 0;
+  struct lms_slot_info info;
+  char buff[4096], rec[32];
+  if ( w < 0 || r < 0 || ioctl(w, GET_SLOT_INFO, &info) != 0 ) return;
+  while ( read(r, buff, sizeof(buff)) > 0 );
+  ioctl(w, CHANGE_MESSAGE_SIZE, info.max_msg_size);
+  if ( ioctl(w, CHANGE_COALESCING, 100) != 0 ) return;
+  for (int i = 0; i < records; i++) write(w, rec, snprintf(rec, sizeof(rec), "record %d", i));
+  ioctl(w, FLUSH_MESSAGES, 0);
+  int n = read(r, buff, sizeof(buff));
+  struct lms_coalesced* batch = (struct lms_coalesced*) buff;
+  if ( n > 0 && batch->magic == LMS_COALESCED_MAGIC ){
+    __u32* index = (__u32*) (buff + batch->index);
+    got = batch->count;
+    printf("coalescing: %d bytes, last record %.*s\n", n, (int) *(__u32*) (buff + index[got - 1]), buff + index[got - 1] + LMS_RING_HDR_SIZE);
+  }
+  printf("coalescing: %d records in the first batch, %s\n", got, got == records ? "ok" : "WRONG");
+  ioctl(w, CHANGE_COALESCING, 0);
+  close(w);
+  close(r);
+}
+
+//a batch of 256 bytes filled up to the last byte by records of 4 and 220 bytes, the record of
+//200 bytes after them has to go to a new batch and not past the end of the buffer
+void test_coalescing_full(const char* path){
+  int w = open(path, O_WRONLY), r = open(path, O_RDONLY | O_NONBLOCK), first = 0, second = 0;
+  char buff[4096], rec[256];
+  struct lms_coalesced* batch = (struct lms_coalesced*) buff;
+  if ( w < 0 || r < 0 ) return;
+  while ( read(r, buff, sizeof(buff)) > 0 );
+  memset(rec, 'x', sizeof(rec));
+  ioctl(w, CHANGE_MESSAGE_SIZE, 256);
+  if ( ioctl(w, CHANGE_COALESCING, 1000) != 0 ) return;
+  write(w, rec, 4);
+  write(w, rec, 220);
+  write(w, rec, 200);
+  ioctl(w, FLUSH_MESSAGES, 0);
+  if ( read(r, buff, sizeof(buff)) > 0 && batch->magic == LMS_COALESCED_MAGIC ) first = batch->count;
+  if ( read(r, buff, sizeof(buff)) > 0 && batch->magic == LMS_COALESCED_MAGIC ) second = batch->count;
+  printf("coalescing: full batch of %d records, then %d, %s\n", first, second, first == 2 && second == 1 ? "ok" : "WRONG");
+  ioctl(w, CHANGE_COALESCING, 0);
+  close(w);
+  close(r);
+}
+
+//one way latency of messages written every 100 us, the reader sleeping or spinning us on the empty slot
+static double busy_poll_run(const char* path, int us, int messages){
+  int fd = open(path, O_RDWR), status;
+  double sent, total = 0;
+  if ( fd < 0 ) return 0;
+  ioctl(fd, CHANGE_BLOCKING_MODE, 0);
+  while ( read(fd, &sent, sizeof(sent)) > 0 ) ;
+  ioctl(fd, CHANGE_BLOCKING_MODE, 1);
+  ioctl(fd, CHANGE_BUSY_POLL, us);
+  if (fork() == 0) {
+    for (int i = 0; i < messages; i++){
+      usleep(100);
+      sent = now_sec();
+      write(fd, &sent, sizeof(sent));
+    }
+    exit(0);
+  }
+  for (int i = 0; i < messages; i++){
+    if ( read(fd, &sent, sizeof(sent)) == sizeof(sent) ) total += now_sec() - sent;
+  }
+  wait(&status);
+  close(fd);
+  return total * 1e6 / messages;
+}
+
+void test_busy_poll(const char* path, int us){
+  double slept = busy_poll_run(path, 0, 10000);
+  double spun = busy_poll_run(path, us, 10000);
+  printf("busy poll: %.2f us per message sleeping, %.2f us spinning up to %d us (spin_hits in debugfs)\n", slept, spun, us);
+}
+
+//writers and readers hammer the slot in every storage mode, once drained the whole budget has to be
+//free again and no message left counted, any difference is capacity leaked by the accounting
+void test_stress(const char* path, int procs, int messages){
+  static const int modes[] = {STORAGE_LIST, STORAGE_LOCKFREE, STORAGE_BROADCAST};
+  struct lms_slot_info info;
+  char buff[256];
+  int status;
+  for (int m = 0; m < 3; m++){
+    int fd = open(path, O_RDWR | O_NONBLOCK);
+    if ( fd < 0 ) return;
+    while ( read(fd, buff, sizeof(buff)) > 0 );
+    if ( ioctl(fd, CHANGE_STORAGE_MODE, modes[m]) != 0 ){
+      close(fd);
+      continue;
+    }
+    for (int p = 0; p < 2 * procs; p++){
+      if (fork() == 0) {
+        //nothing blocks, a write to a full slot and a read of an empty one just fail
+        int c = open(path, (p < procs ? O_WRONLY : O_RDONLY) | O_NONBLOCK);
+        for (int i = 0; i < messages; i++){
+          if ( p < procs ) write(c, buff, 1 + rand() % sizeof(buff));
+          else read(c, buff, sizeof(buff));
+        }
+        close(c);
+        exit(0);
+      }
+    }
+    for (int p = 0; p < 2 * procs; p++) wait(&status);
+    while ( read(fd, buff, sizeof(buff)) > 0 );
+    ioctl(fd, GET_SLOT_INFO, &info);
+    printf("stress: storage %d, free %u of %u, %u messages counted, %s\n", modes[m], info.free, info.budget, info.msgs, info.free == info.budget && info.msgs == 0 ? "ok" : "LEAK");
+    ioctl(fd, CHANGE_STORAGE_MODE, STORAGE_LIST);
+    close(fd);
+  }
+}
+
+//a spilling slot takes messages far beyond its budget without blocking and gives them back in
+//write order, the module has to be loaded with spill_dir
+void test_spill(const char* path, int messages){
+  int fd = open(path, O_RDWR | O_NONBLOCK), written = 0, got = 0, i, n;
+  struct lms_slot_info info;
+  if ( fd < 0 ) return;
+  while ( read(fd, &n, sizeof(n)) > 0 );
+  if ( ioctl(fd, CHANGE_SPILL, 1) != 0 ){
+    printf("spill: cannot start spilling, is spill_dir set?\n");
+    close(fd);
+    return;
+  }
+  for (i = 0; i < messages; i++) if ( write(fd, &i, sizeof(i)) == sizeof(i) ) written++;
+  ioctl(fd, GET_SLOT_INFO, &info);
+  printf("spill: %d messages written, %u in memory and %u on disk\n", written, info.msgs, info.spilled);
+  while ( read(fd, &n, sizeof(n)) == sizeof(n) && n == got ) got++;
+  printf("spill: %d read back in order, %s\n", got, got == messages && written == messages ? "ok" : "WRONG");
+  ioctl(fd, CHANGE_SPILL, 0);
+  close(fd);
+}
+
+
 int main(int argc, char const *argv[]) {
 
+  //./prova contention [node] [readers] [messages]
+  if ( argc > 1 && strcmp(argv[1], "contention") == 0 ){
+    contention_test(argc > 2 ? argv[2] : "testNode", argc > 3 ? atoi(argv[3]) : 64, argc > 4 ? atoi(argv[4]) : 100000, 64);
+    return 0;
+  }
+  //./prova throughput [node] [writers] [messages]
+  if ( argc > 1 && strcmp(argv[1], "throughput") == 0 ){
+    throughput_test(argc > 2 ? argv[2] : "testNode", argc > 3 ? atoi(argv[3]) : sysconf(_SC_NPROCESSORS_ONLN), argc > 4 ? atoi(argv[4]) : 1000000, 64);
+    return 0;
+  }
+  //./prova priority [node]
+  if ( argc > 1 && strcmp(argv[1], "priority") == 0 ){
+    test_priority(argc > 2 ? argv[2] : "testNode");
+    return 0;
+  }
+  //./prova peek [node]
+  if ( argc > 1 && strcmp(argv[1], "peek") == 0 ){
+    test_peek(argc > 2 ? argv[2] : "testNode");
+    return 0;
+  }
+  //./prova forward [src node] [dst node]
+  if ( argc > 1 && strcmp(argv[1], "forward") == 0 ){
+    test_forward(argc > 2 ? argv[2] : "testNode", argc > 3 ? argv[3] : "Node");
+    return 0;
+  }
+  //./prova overflow [node]
+  if ( argc > 1 && strcmp(argv[1], "overflow") == 0 ){
+    test_overflow(argc > 2 ? argv[2] : "testNode");
+    return 0;
+  }
+  //./prova timeout [node] [ms]
+  if ( argc > 1 && strcmp(argv[1], "timeout") == 0 ){
+    test_timeout(argc > 2 ? argv[2] : "testNode", argc > 3 ? atoi(argv[3]) : 100);
+    return 0;
+  }
+  //./prova broadcast [node] [readers]
+  if ( argc > 1 && strcmp(argv[1], "broadcast") == 0 ){
+    test_broadcast(argc > 2 ? argv[2] : "testNode", argc > 3 ? atoi(argv[3]) : 4);
+    return 0;
+  }
+  //./prova busypoll [node] [us]
+  if ( argc > 1 && strcmp(argv[1], "busypoll") == 0 ){
+    test_busy_poll(argc > 2 ? argv[2] : "testNode", argc > 3 ? atoi(argv[3]) : 200);
+    return 0;
+  }
+  //./prova coalescing [node] [records]
+  if ( argc > 1 && strcmp(argv[1], "coalescing") == 0 ){
+    test_coalescing(argc > 2 ? argv[2] : "testNode", argc > 3 ? atoi(argv[3]) : 20);
+    test_coalescing_full(argc > 2 ? argv[2] : "testNode");
+    return 0;
+  }
+  //./prova stress [node] [procs] [messages]
+  if ( argc > 1 && strcmp(argv[1], "stress") == 0 ){
+    test_stress(argc > 2 ? argv[2] : "testNode", argc > 3 ? atoi(argv[3]) : 4, argc > 4 ? atoi(argv[4]) : 100000);
+    return 0;
+  }
+  //./prova ring [node] [len]
+  if ( argc > 1 && strcmp(argv[1], "ring") == 0 ){
+    test_ring_mmap(argc > 2 ? argv[2] : "testNode", argc > 3 ? atoi(argv[3]) : 64);
+    return 0;
+  }
+  //./prova spill [node] [messages]
+  if ( argc > 1 && strcmp(argv[1], "spill") == 0 ){
+    test_spill(argc > 2 ? argv[2] : "testNode", argc > 3 ? atoi(argv[3]) : 100000);
+    return 0;
+  }
   create_n_process(5, 256 ,"testNode" );
   //do_work_child("testNode", 256 , WRITE);
   //do_work_child("testNode", 256 , READ);